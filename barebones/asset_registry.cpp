@@ -0,0 +1,149 @@
+#include "asset_registry.hpp"
+#include "gl_state.hpp"
+#include <cstring>
+
+uint64_t content_hash(const void* data,size_t len,uint64_t seed) {
+	// MurmurHash64A, Austin Appleby, public domain
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	uint64_t h = seed ^ (len * m);
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	for(const unsigned char* end = p + (len & ~(size_t)7); p != end; p += 8) {
+		uint64_t k;
+		memcpy(&k,p,sizeof(k));
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+	switch(len & 7) {
+	case 7: h ^= uint64_t(p[6]) << 48;
+	case 6: h ^= uint64_t(p[5]) << 40;
+	case 5: h ^= uint64_t(p[4]) << 32;
+	case 4: h ^= uint64_t(p[3]) << 24;
+	case 3: h ^= uint64_t(p[2]) << 16;
+	case 2: h ^= uint64_t(p[1]) << 8;
+	case 1: h ^= uint64_t(p[0]);
+		h *= m;
+	};
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+asset_registry_t::key_t::key_t(const void* data,size_t sz,GLenum k):
+	hash(content_hash(data,sz)), check(content_hash(data,sz,0x2545f4914f6cdd1dULL)), size(sz), kind(k) {}
+
+bool asset_registry_t::key_t::operator<(const key_t& other) const {
+	if(hash != other.hash) return hash < other.hash;
+	if(check != other.check) return check < other.check;
+	if(size != other.size) return size < other.size;
+	return kind < other.kind;
+}
+
+asset_registry_t::asset_registry_t(main_t& m): main(m) {}
+
+bool asset_registry_t::can_read_back(GLenum kind) {
+#ifdef __native_client__
+	return false; // GLES2 can't read buffers back
+#else
+	return kind == GL_ARRAY_BUFFER || kind == GL_ELEMENT_ARRAY_BUFFER;
+#endif
+}
+
+bool asset_registry_t::same(const key_t& key,const entry_t& entry,const void* data) {
+	if(!can_read_back(key.kind))
+		return true;
+#ifndef __native_client__
+	// only on a hit, and so only as things load
+	std::string stored(key.size,'\0');
+	glBindBuffer(key.kind,entry.alloc.buffer);
+	glGetBufferSubData(key.kind,entry.alloc.offset,key.size,&stored[0]);
+	glBindBuffer(key.kind,0); // as buffer_arena_t::upload leaves it
+	glCheck();
+	return !memcmp(stored.data(),data,key.size);
+#else
+	return false;
+#endif
+}
+
+asset_registry_t::entries_t::iterator asset_registry_t::find(const key_t& key,const void* data) {
+	std::pair<entries_t::iterator,entries_t::iterator> range = entries.equal_range(key);
+	for(entries_t::iterator e=range.first; e!=range.second; e++) {
+		if(same(key,e->second,data))
+			return e;
+		_stats.collisions++;
+	}
+	return entries.end();
+}
+
+buffer_arena_t::alloc_t asset_registry_t::acquire_buffer(GLenum target,const void* data,size_t size) {
+	const key_t key(data,size,target);
+	_stats.buffer_requests++;
+	_stats.buffer_bytes_requested += size;
+	entries_t::iterator e = find(key,data);
+	if(e != entries.end()) {
+		_stats.buffer_hits++;
+		e->second.refs++;
+		return e->second.alloc;
+	}
+	buffer_arena_t& arena = main.get_buffer_arena(target);
+	e = entries.insert(std::make_pair(key,entry_t()));
+	entry_t& entry = e->second;
+	entry.alloc = arena.alloc(size);
+	arena.upload(entry.alloc,0,size,data);
+	entry.refs = 1;
+	buffer_keys.insert(std::make_pair(std::make_pair(entry.alloc.buffer,entry.alloc.offset),e));
+	_stats.buffer_bytes_stored += size;
+	return entry.alloc;
+}
+
+void asset_registry_t::release_buffer(GLenum target,buffer_arena_t::alloc_t& alloc) {
+	if(!alloc.buffer) return;
+	buffer_keys_t::iterator k = buffer_keys.find(std::make_pair(alloc.buffer,alloc.offset));
+	if(k == buffer_keys.end())
+		panic("release of unregistered buffer " << alloc.buffer << '+' << alloc.offset);
+	entries_t::iterator e = k->second;
+	if(!--e->second.refs) {
+		_stats.buffer_bytes_stored -= e->first.size;
+		main.get_buffer_arena(target).free(e->second.alloc);
+		buffer_keys.erase(k);
+		entries.erase(e);
+	}
+	alloc = buffer_arena_t::alloc_t();
+}
+
+GLuint asset_registry_t::acquire_texture(GLenum kind,const void* data,size_t size) {
+	_stats.texture_requests++;
+	entries_t::iterator e = find(key_t(data,size,kind),data);
+	if(e == entries.end())
+		return 0;
+	_stats.texture_hits++;
+	e->second.refs++;
+	return e->second.handle;
+}
+
+void asset_registry_t::add_texture(GLenum kind,const void* data,size_t size,GLuint handle) {
+	if(texture_keys.find(handle) != texture_keys.end())
+		panic("texture " << handle << " added twice");
+	entries_t::iterator e = entries.insert(std::make_pair(key_t(data,size,kind),entry_t()));
+	e->second.refs = 1;
+	e->second.handle = handle;
+	texture_keys.insert(std::make_pair(handle,e));
+}
+
+void asset_registry_t::release_texture(GLuint& handle) {
+	if(!handle) return;
+	texture_keys_t::iterator k = texture_keys.find(handle);
+	if(k == texture_keys.end())
+		panic("release of unregistered texture " << handle);
+	entries_t::iterator e = k->second;
+	if(!--e->second.refs) {
+		main.get_gl_state().delete_texture(handle);
+		texture_keys.erase(k);
+		entries.erase(e);
+	}
+	handle = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef __ASSET_REGISTRY_HPP__
+#define __ASSET_REGISTRY_HPP__
+
+#include "buffer_arena.hpp"
+#include <map>
+
+uint64_t content_hash(const void* data,size_t len,uint64_t seed=0x8445d61a4e774912ULL); // MurmurHash64A; not for adversarial input
+
+// content-addressed GL objects: uploads with identical bytes share one object, reference-counted.
+// Keys are two independently seeded hashes, size and kind.  Buffers are also read back and compared
+// where GL can; elsewhere, and for textures, whose contents aren't the bytes they were made from,
+// the 128 bits of hash are trusted, so that no copy of the bytes need be kept
+class asset_registry_t {
+public:
+	asset_registry_t(main_t& main);
+	struct key_t {
+		key_t(const void* data,size_t size,GLenum kind);
+		uint64_t hash, check; // differently seeded
+		size_t size;
+		GLenum kind; // buffer target, GL_TEXTURE_2D for image files, or a texture's internal format
+		bool operator<(const key_t& other) const;
+	};
+	// an arena allocation holding data, shared with any identical earlier upload to the same target
+	buffer_arena_t::alloc_t acquire_buffer(GLenum target,const void* data,size_t size);
+	void release_buffer(GLenum target,buffer_arena_t::alloc_t& alloc);
+	// textures, keyed by the bytes they are made from; the caller decodes and uploads on a miss, then adds the handle
+	GLuint acquire_texture(GLenum kind,const void* data,size_t size); // 0 if not present
+	void add_texture(GLenum kind,const void* data,size_t size,GLuint handle);
+	void release_texture(GLuint& handle); // deletes it with the last reference, and zeroes handle
+	struct stats_t {
+		stats_t(): buffer_requests(0), buffer_hits(0), buffer_bytes_requested(0), buffer_bytes_stored(0),
+			texture_requests(0), texture_hits(0), collisions(0) {}
+		size_t buffer_requests, buffer_hits, buffer_bytes_requested, buffer_bytes_stored;
+		size_t texture_requests, texture_hits;
+		size_t collisions; // same key, different bytes, as found by reading back
+	};
+	const stats_t& stats() const { return _stats; }
+private:
+	main_t& main;
+	struct entry_t {
+		entry_t(): refs(0), handle(0) {}
+		size_t refs;
+		buffer_arena_t::alloc_t alloc;
+		GLuint handle;
+	};
+	typedef std::multimap<key_t,entry_t> entries_t; // colliding keys have an entry each
+	entries_t entries;
+	entries_t::iterator find(const key_t& key,const void* data);
+	bool same(const key_t& key,const entry_t& entry,const void* data);
+	static bool can_read_back(GLenum kind);
+	typedef std::map<std::pair<GLuint,GLintptr>,entries_t::iterator> buffer_keys_t; // to find an allocation's entry on release
+	buffer_keys_t buffer_keys;
+	typedef std::map<GLuint,entries_t::iterator> texture_keys_t;
+	texture_keys_t texture_keys;
+	stats_t _stats;
+};
+
+#endif//__ASSET_REGISTRY_HPP__
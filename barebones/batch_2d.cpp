@@ -0,0 +1,119 @@
+#include "batch_2d.hpp"
+#include "gl_state.hpp"
+#include <cstddef>
+
+batch_2d_t::batch_2d_t(main_t& m): main(m), vbo(0), vbo_size(0) {
+	flat_program = main.get_shared_program("batch_2d");
+	graphics_assert(flat_program && "batch_2d"); // provided by game adaptation
+	flat_attrib_vertex = main.get_attribute_loc(flat_program,"VERTEX",GL_FLOAT_VEC4);
+	flat_attrib_colour = main.get_attribute_loc(flat_program,"COLOUR",GL_FLOAT_VEC4);
+	textured_program = main.get_shared_program("batch_2d_textured");
+	graphics_assert(textured_program && "batch_2d_textured"); // provided by game adaptation
+	textured_attrib_vertex = main.get_attribute_loc(textured_program,"VERTEX",GL_FLOAT_VEC4);
+	textured_attrib_colour = main.get_attribute_loc(textured_program,"COLOUR",GL_FLOAT_VEC4);
+	textured_attrib_tex = main.get_attribute_loc(textured_program,"TEX_COORD_0",GL_FLOAT_VEC2);
+	main.get_gl_state().use_program(textured_program);
+	glUniform1i(main.get_uniform_loc(textured_program,"TEX_UNIT_0"),0);
+	glGenBuffers(1,&vbo);
+	glCheck();
+}
+
+batch_2d_t::~batch_2d_t() {
+	main.get_gl_state().delete_buffer(vbo);
+}
+
+void batch_2d_t::line(const glm::mat4& mvp,const glm::vec3& a,const glm::vec3& b,const glm::vec4& colour) {
+	start(LINES,0);
+	add(mvp,a,colour);
+	add(mvp,b,colour);
+}
+
+void batch_2d_t::quad(const glm::mat4& mvp,const glm::vec3& bl,const glm::vec2& tr,const glm::vec4& colour) {
+	start(FLAT,0);
+	add_quad(mvp,bl,tr,colour);
+}
+
+void batch_2d_t::quad(const glm::mat4& mvp,const glm::vec3& bl,const glm::vec2& tr,GLuint texture,
+	const glm::vec2& tex_bl,const glm::vec2& tex_tr,const glm::vec4& colour) {
+	start(TEXTURED,texture);
+	add_quad(mvp,bl,tr,colour,tex_bl,tex_tr);
+}
+
+void batch_2d_t::start(int kind,GLuint texture) {
+	if(runs.size() && runs.back().kind == kind && runs.back().texture == texture)
+		return;
+	const run_t run = {kind,texture,(GLint)all.size(),0};
+	runs.push_back(run);
+}
+
+void batch_2d_t::add(const glm::mat4& mvp,const glm::vec3& pos,const glm::vec4& colour,const glm::vec2& tex) {
+	const glm::vec4 p(mvp*glm::vec4(pos,1));
+	const vertex_t v = {{p.x,p.y,p.z,p.w},{colour.x,colour.y,colour.z,colour.w},{tex.x,tex.y}};
+	all.push_back(v);
+	runs.back().count++;
+}
+
+void batch_2d_t::add_quad(const glm::mat4& mvp,const glm::vec3& bl,const glm::vec2& tr,const glm::vec4& colour,
+	const glm::vec2& tex_bl,const glm::vec2& tex_tr) {
+	// two anticlockwise triangles, so quads from all over share a draw
+	const glm::vec3 br(tr.x,bl.y,bl.z), tl(bl.x,tr.y,bl.z), tr_3(tr,bl.z);
+	const glm::vec2 tex_br(tex_tr.x,tex_bl.y), tex_tl(tex_bl.x,tex_tr.y);
+	add(mvp,bl,colour,tex_bl);
+	add(mvp,br,colour,tex_br);
+	add(mvp,tr_3,colour,tex_tr);
+	add(mvp,bl,colour,tex_bl);
+	add(mvp,tr_3,colour,tex_tr);
+	add(mvp,tl,colour,tex_tl);
+}
+
+void batch_2d_t::flush() {
+	if(all.empty()) return;
+	gl_state_t& gl = main.get_gl_state();
+	gl.bind_vertex_array(0); // pointers set are the bound vertex array's
+	gl.bind_buffer(GL_ARRAY_BUFFER,vbo);
+	const GLsizeiptr size = all.size()*sizeof(vertex_t);
+	if(size > vbo_size) {
+		vbo_size = std::max<GLsizeiptr>(size,vbo_size*2);
+		_stats.buffer_bytes = vbo_size;
+	}
+	// orphan the storage the last flush's draws may still be reading, rather than wait for them
+	glBufferData(GL_ARRAY_BUFFER,vbo_size,NULL,GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER,0,size,&all[0]);
+	glCheck();
+	int kind = -1;
+	for(runs_t::const_iterator r=runs.begin(); r!=runs.end(); r++) {
+		const bool textured = (r->kind == TEXTURED);
+		const GLuint attrib_vertex = textured? textured_attrib_vertex: flat_attrib_vertex,
+			attrib_colour = textured? textured_attrib_colour: flat_attrib_colour;
+		if(r->kind != kind) { // the pointers are set from the start of the buffer, so draws go by first vertex
+			gl.use_program(textured? textured_program: flat_program);
+			uint32_t attribs = gl_state_t::attrib_bit(attrib_vertex) | gl_state_t::attrib_bit(attrib_colour);
+			glVertexAttribPointer(attrib_vertex,4,GL_FLOAT,GL_FALSE,sizeof(vertex_t),(GLvoid*)offsetof(vertex_t,pos));
+			glVertexAttribPointer(attrib_colour,4,GL_FLOAT,GL_FALSE,sizeof(vertex_t),(GLvoid*)offsetof(vertex_t,colour));
+			if(textured) {
+				glVertexAttribPointer(textured_attrib_tex,2,GL_FLOAT,GL_FALSE,sizeof(vertex_t),(GLvoid*)offsetof(vertex_t,tex));
+				attribs |= gl_state_t::attrib_bit(textured_attrib_tex);
+			}
+			gl.use_attribs(attribs);
+			if(r->kind == LINES)
+				glLineWidth(LINE_WIDTH);
+			glCheck();
+			kind = r->kind;
+		}
+		if(textured)
+			gl.bind_texture(0,r->texture);
+		gl.draw_arrays((r->kind == LINES)? GL_LINES: GL_TRIANGLES,r->first,r->count);
+		glCheck();
+		_stats.draws++;
+	}
+	_stats.vertices += all.size();
+	_stats.flushes++;
+	all.clear();
+	runs.clear();
+}
+
+void batch_2d_t::reset_stats() {
+	const size_t buffer_bytes = _stats.buffer_bytes;
+	_stats = stats_t();
+	_stats.buffer_bytes = buffer_bytes;
+}
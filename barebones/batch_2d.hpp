@@ -0,0 +1,60 @@
+#ifndef __BATCH_2D_HPP__
+#define __BATCH_2D_HPP__
+
+#include "main.hpp"
+#include "../external/ogl-math/glm/glm.hpp"
+
+/* lines and flat or textured quads, gathered over a frame and drawn from one streaming buffer that
+   is orphaned and refilled at each flush().  Vertices are transformed as they are added, so things
+   drawn with different matrices still share draws.  Everything is drawn in the order added: a run
+   of the same kind and texture is one draw, and a change of either starts the next, so interleaving
+   kinds or textures costs draws.
+   main_t flushes at the end of each frame; flush sooner if changing GL state we don't set
+   (blending, depth, stencil) or the framebuffer.  Needs the game adaptation to provide
+   "batch_2d" and "batch_2d_textured" programs */
+class batch_2d_t {
+public:
+	enum { LINE_WIDTH = 2 };
+	batch_2d_t(main_t& main);
+	~batch_2d_t();
+	void line(const glm::mat4& mvp,const glm::vec3& a,const glm::vec3& b,const glm::vec4& colour);
+	// quads are axis-aligned in the model's xy plane, at bl's z
+	void quad(const glm::mat4& mvp,const glm::vec3& bl,const glm::vec2& tr,const glm::vec4& colour);
+	void quad(const glm::mat4& mvp,const glm::vec3& bl,const glm::vec2& tr,GLuint texture,
+		const glm::vec2& tex_bl,const glm::vec2& tex_tr,const glm::vec4& colour = glm::vec4(1,1,1,1));
+	void flush();
+	main_t& main;
+	struct stats_t {
+		stats_t(): flushes(0), draws(0), vertices(0), buffer_bytes(0) {}
+		size_t flushes, draws, vertices; // since reset_stats()
+		size_t buffer_bytes; // the streaming buffer's size
+	};
+	const stats_t& stats() const { return _stats; }
+	void reset_stats();
+private:
+	struct vertex_t {
+		GLfloat pos[4], colour[4], tex[2];
+	};
+	typedef std::vector<vertex_t> vertices_t;
+	enum { FLAT, TEXTURED, LINES }; // FLAT and LINES share a program
+	struct run_t {
+		int kind;
+		GLuint texture;
+		GLint first;
+		GLsizei count;
+	};
+	typedef std::vector<run_t> runs_t;
+	runs_t runs; // kept, as is all's capacity, between flushes
+	void start(int kind,GLuint texture); // a run, unless it would continue the last
+	void add(const glm::mat4& mvp,const glm::vec3& pos,const glm::vec4& colour,const glm::vec2& tex=glm::vec2(0,0));
+	void add_quad(const glm::mat4& mvp,const glm::vec3& bl,const glm::vec2& tr,const glm::vec4& colour,
+		const glm::vec2& tex_bl=glm::vec2(0,0),const glm::vec2& tex_tr=glm::vec2(0,0));
+	vertices_t all;
+	GLuint vbo;
+	GLsizeiptr vbo_size;
+	GLuint flat_program, flat_attrib_vertex, flat_attrib_colour,
+		textured_program, textured_attrib_vertex, textured_attrib_colour, textured_attrib_tex;
+	stats_t _stats;
+};
+
+#endif//__BATCH_2D_HPP__
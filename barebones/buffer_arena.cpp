@@ -0,0 +1,84 @@
+#include "buffer_arena.hpp"
+
+buffer_arena_t::buffer_arena_t(GLenum t,GLsizeiptr ps): target(t), page_size(ps) {}
+
+buffer_arena_t::~buffer_arena_t() {
+	for(pages_t::iterator p=pages.begin(); p!=pages.end(); p++)
+		if(p->buffer)
+			glDeleteBuffers(1,&p->buffer);
+}
+
+buffer_arena_t::alloc_t buffer_arena_t::alloc(GLsizeiptr size) {
+	if(size <= 0) panic("cannot allocate " << size << " bytes");
+	const GLsizeiptr aligned = (size+ALIGN-1) & ~(GLsizeiptr)(ALIGN-1);
+	// first fit among the live pages, else the first dead slot, else a new slot
+	int slot = -1;
+	for(size_t i=0; i<pages.size(); i++)
+		if(pages[i].buffer) {
+			if(pages[i].size-pages[i].used >= aligned) {
+				slot = i;
+				break;
+			}
+		} else if(slot < 0)
+			slot = i;
+	if(slot < 0 || !pages[slot].buffer) {
+		if(slot < 0) {
+			slot = pages.size();
+			pages.push_back(page_t());
+		}
+		page_t& page = pages[slot];
+		page.size = std::max(page_size,aligned);
+		page.used = 0;
+		page.allocs = 0;
+		glGenBuffers(1,&page.buffer);
+		glBindBuffer(target,page.buffer);
+		glBufferData(target,page.size,NULL,GL_STATIC_DRAW);
+		glBindBuffer(target,0);
+		glCheck();
+	}
+	page_t& page = pages[slot];
+	alloc_t a;
+	a.buffer = page.buffer;
+	a.offset = page.used;
+	a.size = size;
+	a.page = slot;
+	page.used += aligned;
+	page.allocs++;
+	return a;
+}
+
+void buffer_arena_t::upload(const alloc_t& a,GLintptr ofs,GLsizeiptr size,const void* data) {
+	if((a.page < 0) || (ofs < 0) || (ofs+size > a.size))
+		panic("upload of " << size << " bytes at " << ofs << " overruns allocation of " << a.size);
+	glBindBuffer(target,a.buffer);
+	glBufferSubData(target,a.offset+ofs,size,data);
+	glBindBuffer(target,0);
+	glCheck();
+}
+
+void buffer_arena_t::free(alloc_t& a) {
+	if(a.page < 0) return;
+	page_t& page = pages.at(a.page);
+	if(page.buffer != a.buffer || !page.allocs)
+		panic("stray free of buffer " << a.buffer << " page " << a.page);
+	if(!--page.allocs) {
+		glDeleteBuffers(1,&page.buffer);
+		page.buffer = 0;
+	}
+	a = alloc_t();
+}
+
+size_t buffer_arena_t::buffer_count() const {
+	size_t count = 0;
+	for(pages_t::const_iterator p=pages.begin(); p!=pages.end(); p++)
+		if(p->buffer)
+			count++;
+	return count;
+}
+
+size_t buffer_arena_t::alloc_count() const {
+	size_t count = 0;
+	for(pages_t::const_iterator p=pages.begin(); p!=pages.end(); p++)
+		count += p->allocs;
+	return count;
+}
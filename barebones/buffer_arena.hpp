@@ -0,0 +1,40 @@
+#ifndef __BUFFER_ARENA_HPP__
+#define __BUFFER_ARENA_HPP__
+
+#include "main.hpp"
+
+// suballocates static arrays out of a few large buffer objects ("pages"), so that many
+// small meshes share one buffer and are drawn by offset into it.  Allocations bigger
+// than a page get a page of their own; a page is deleted when its last allocation is freed
+class buffer_arena_t {
+public:
+	enum { DEFAULT_PAGE_SIZE = 1024*1024, ALIGN = 16 };
+	buffer_arena_t(GLenum target,GLsizeiptr page_size = DEFAULT_PAGE_SIZE);
+	~buffer_arena_t();
+	struct alloc_t {
+		alloc_t(): buffer(0), offset(0), size(0), page(-1) {}
+		GLuint buffer;
+		GLintptr offset;
+		GLsizeiptr size;
+		int page;
+		// offsets into the buffer, as gl*Pointer and glDrawElements want them
+		const void* ptr(GLintptr ofs=0) const { return reinterpret_cast<const void*>(offset+ofs); }
+	};
+	alloc_t alloc(GLsizeiptr size);
+	void upload(const alloc_t& alloc,GLintptr ofs,GLsizeiptr size,const void* data); // leaves target unbound
+	void free(alloc_t& alloc);
+	const GLenum target;
+	const GLsizeiptr page_size;
+	size_t buffer_count() const; // live buffer objects
+	size_t alloc_count() const;
+private:
+	struct page_t {
+		GLuint buffer;
+		GLsizeiptr size, used;
+		size_t allocs;
+	};
+	typedef std::vector<page_t> pages_t;
+	pages_t pages;
+};
+
+#endif//__BUFFER_ARENA_HPP__
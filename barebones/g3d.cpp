@@ -1,238 +1,664 @@
 #include "g3d.hpp"
+#include "asset_registry.hpp"
+#include "jobs.hpp"
+#include "gl_state.hpp"
+#include "rand.hpp"
 #include <iostream>
+#include <map>
+#include <algorithm>
+#include <memory>
 #include <limits>
+#include <cstddef>
 
-struct g3d_t::mesh_t: private main_t::texture_load_t {
+// per instance, as the instanced programs' attributes take it
+struct g3d_t::instance_data_t {
+	GLfloat mvp_matrix[16], normal_matrix[9], lerp, colour[4];
+};
+
+struct g3d_t::mesh_t: public g3d_data_t::mesh_t, private main_t::texture_load_t {
 public:
-	mesh_t(g3d_t& g3d,binary_reader_t& in,char ver);
+	mesh_t(g3d_t& g3d,g3d_data_t::mesh_t& data);
 	virtual ~mesh_t();
-	void draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light_0,bool cycles,const glm::vec4& colour);
-	bool is_ready() const { return i_vbo && (!(textures&1) || texture); }
+	void discard_cpu_copy(); // RETAIN_CPU_COPY only
+	void release_gl(); // buffers, vertex arrays and frame texture; the mesh can't be drawn after
+	bool can_draw() const; // complains if not
+	// with the program in use and the uniforms every mesh of the object shares already set
+	void draw(float time,bool cycles,const glm::mat4& mvp,const glm::vec4& colour);
+	// each pose the instances are in is one instanced draw; mvps are theirs, as are the transforms in per_instance
+	void draw_instanced(const instances_t& instances,const glm::mat4* mvps,const instance_data_t* per_instance,bool cycles,const glm::vec3& light_0);
+	bool is_ready() const { return i_buf.buffer && (!(textures&1) || texture); }
 	g3d_t& g3d;
-	std::string name;
-	uint32_t frame_count, vertex_count, index_count, textures, tex_frame_count;
-	GLfloat* vn_data;
-	GLfloat* t_data;
-	GLushort* i_data;
-	GLuint* vn_vbo; // per frame
-	GLuint* t_vbo; // per tex_frame
-	GLuint i_vbo;
+	// each frame, UV set and index array is shared with any identical one via the asset registry
+	typedef std::vector<buffer_arena_t::alloc_t> bufs_t;
+	bufs_t vn_bufs; // per frame
+	bufs_t t_bufs; // per tex frame
+	buffer_arena_t::alloc_t i_buf;
+	// the layout in GL, which differs from the CPU arrays' when quantised
+	GLsizei vn_stride, t_stride;
+	GLenum vertex_type, normal_type, tex_type;
+	GLint normal_size;
+	glm::vec3 vertex_offset, vertex_scale;
+	glm::vec2 tex_offset, tex_scale;
+	// with FRAME_TEXTURES, the frames are texels instead and the vertex input is each vertex's index
+	GLuint frame_texture;
+	GLsizei frame_texture_width, frame_texture_height;
+	buffer_arena_t::alloc_t vertex_index_buf;
+	size_t gpu_bytes() const { return vertex_count*(frame_count*vn_stride + tex_frame_count*t_stride + (frame_texture? sizeof(GLushort): 0)) + i_size() + lods_size(); }
+	bool upload_frame_texture();
+	size_t decimated_bytes() const { return vertex_count*(source_frame_count()-frame_count)*vn_stride; }
+	bufs_t lod_bufs; // per level of detail
+	size_t lod_level(const glm::mat4& mvp) const;
+	size_t tex_frame_at(float time) const;
+	void count_draw(size_t level,size_t instances=1);
+	struct attribs_t { // a program's vertex input locations
+		GLuint vertex_0, normal_0, vertex_1, normal_1, tex, vertex_index;
+	};
+	// point a program's attributes at a pose's buffers, returning which locations it uses
+	uint32_t point_attribs(const attribs_t& locations,uint32_t frame_0,uint32_t frame_1,size_t tex_frame);
+	// with vertex array objects, each pose drawn gets one, made the first time it is drawn
+	struct vertex_array_t {
+		vertex_array_t(): vertex_array(0), element_buffer(0) {}
+		GLuint vertex_array, element_buffer;
+	};
+	typedef std::map<uint64_t,vertex_array_t> vertex_arrays_t; // frame_0, frame_1, tex_frame
+	vertex_arrays_t vertex_arrays;
+	vertex_array_t& vertex_array(uint32_t frame_0,uint32_t frame_1,size_t tex_frame);
+	float pixels_per_unit(const glm::mat4& mvp) const;
+	void acquire_bufs(bufs_t& bufs,size_t count,const void* data,size_t size);
 	GLuint texture, program,
 		uniform_mvp_matrix, uniform_normal_matrix, uniform_light_0, uniform_colour,
-		attrib_vertex_0, attrib_normal_0,
-		attrib_vertex_1, attrib_normal_1, uniform_lerp,
-		attrib_tex;
-	glm::vec3 min, max;
+		uniform_lerp,
+		uniform_vertex_offset, uniform_vertex_scale, uniform_tex_offset, uniform_tex_scale,
+		uniform_frame_0, uniform_frame_1, uniform_frames_size;
+	attribs_t attribs;
+	// the instanced program, where there is one, has the transforms, lerp and colour as per instance attributes
+	GLuint instanced_program,
+		instanced_light_0, instanced_vertex_offset, instanced_vertex_scale, instanced_tex_offset, instanced_tex_scale,
+		instanced_mvp_matrix, instanced_normal_matrix, instanced_lerp, instanced_colour;
+	attribs_t instanced_attribs;
 private:
 	void on_texture_loaded(const std::string& name,GLuint handle,intptr_t data);
 	enum { LOAD_TEXTURE };
 };
 
-g3d_t::g3d_t(main_t& m,const std::string& fn,loaded_t* o,intptr_t od): main(m), filename(fn),
-	observer(o), observer_data(od) {
-	main.read_file(filename,this,LOAD_G3D);
+namespace {
+	g3d_t::stats_t _stats;
+
+	g3d_data_t::quantised_t::normal_format_t supported_normal_format() {
+	#if defined(__native_client__) || !defined(GL_INT_2_10_10_10_REV)
+		return g3d_data_t::quantised_t::NORMAL_BYTE;
+	#else
+		return (GLEW_VERSION_3_3 || GLEW_ARB_vertex_type_2_10_10_10_rev)?
+			g3d_data_t::quantised_t::NORMAL_10_10_10_2:
+			g3d_data_t::quantised_t::NORMAL_BYTE;
+	#endif
+	}
+
+	enum { FRAME_TEXTURE_WIDTH = 1024 }; // a power of two, so the shader's divide to find the row is exact
+
+	// lod_debug_colours' tints, by level drawn; the full mesh is left alone
+	const glm::vec4 LOD_COLOURS[g3d_data_t::mesh_t::MAX_LODS+1] = {
+		glm::vec4(1,1,1,1), glm::vec4(.4,1,.4,1), glm::vec4(1,1,.3,1), glm::vec4(1,.6,.2,1), glm::vec4(1,.3,.3,1)
+	};
+}
+
+float g3d_t::lod_pixel_error = 1;
+bool g3d_t::lod_debug_colours = false;
+bool g3d_t::use_cooked = true;
+bool g3d_t::use_vertex_arrays = false;
+bool g3d_t::use_instancing = true;
+
+bool g3d_t::frame_textures_supported() {
+#ifdef __native_client__
+	return false; // GLES2 need not fetch textures in vertex shaders, and float textures are an extension
+#else
+	GLint vertex_units = 0;
+	glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS,&vertex_units);
+	glCheck();
+	return (GLEW_VERSION_3_0 || GLEW_ARB_texture_float) && (vertex_units > 0);
+#endif
 }
 
-void g3d_t::on_io(const std::string& name,bool ok,const std::string& bytes,intptr_t data) {
+bool g3d_t::instancing_supported() {
+#ifdef __native_client__
+	return false;
+#else
+	return GLEW_VERSION_3_3;
+#endif
+}
+
+const g3d_t::stats_t& g3d_t::stats() { return _stats; }
+
+void g3d_t::reset_draw_stats() {
+	_stats.mesh_draws = _stats.buffer_binds = _stats.unpooled_buffer_binds = 0;
+	_stats.lod_draws = _stats.lod_triangles_saved = 0;
+	_stats.object_draws = _stats.draw_ns = 0;
+	_stats.matrix_inversions = _stats.uniform_uploads = _stats.unshared_uniform_uploads = 0;
+	_stats.instanced_draws = 0;
+}
+
+g3d_t::g3d_t(main_t& m,const std::string& fn,loaded_t* o,intptr_t od,residency_t r,vertex_format_t vf,float mfe,float le): main(m), filename(fn),
+	residency(r), vertex_format(vf), max_frame_error(mfe), lod_error(le), parsing(NULL), observer(o), observer_data(od) {
+	if(use_cooked)
+		main.read_file(filename+'c',this,LOAD_G3DC,main_t::READ_MAP);
+	else
+		main.read_file(filename,this,LOAD_G3D,main_t::READ_MAP);
+}
+
+// parsing, optimising, decimating and building levels of detail happen on a worker; the meshes are then made, and uploaded, on the GL thread
+struct g3d_t::parse_job_t: public jobs_t::job_t {
+	parse_job_t(g3d_t& g,const main_t::bytes_t& b): g3d(g), bytes(b) {}
+	g3d_t& g3d;
+	main_t::bytes_t bytes; // cooked meshes point into these until they are uploaded
+	g3d_data_t data;
+	std::string error;
+	void run() {
+		try {
+			binary_reader_t in(bytes.data(),bytes.size());
+			data.load(in);
+			if(g3d.max_frame_error > 0)
+				for(g3d_data_t::meshes_t::iterator m=data.meshes.begin(); m!=data.meshes.end(); m++)
+					if(m->key_frames.empty())
+						m->decimate(g3d.max_frame_error);
+			if(g3d.lod_error > 0)
+				for(g3d_data_t::meshes_t::iterator m=data.meshes.begin(); m!=data.meshes.end(); m++)
+					if(m->lods.empty())
+						m->build_lods(g3d.lod_error);
+		} catch(std::exception& e) {
+			error = e.what();
+		}
+	}
+	void on_fire() {
+		std::auto_ptr<parse_job_t> cleanup(this);
+		g3d.on_parsed(*this);
+	}
+};
+
+g3d_t::~g3d_t() {
+	main.cancel_read_file(this,LOAD_G3DC);
+	main.cancel_read_file(this,LOAD_G3D);
+	if(parsing)
+		main.get_jobs().cancel(parsing);
+	for(meshes_t::iterator m=meshes.begin(); m!=meshes.end(); m++)
+		delete *m;
+}
+
+void g3d_t::on_io(const std::string& name,bool ok,const main_t::bytes_t& bytes,intptr_t data) {
 	try {
+		if(LOAD_G3DC == data && (!ok || !bytes.size())) { // not cooked
+			main.read_file(filename,this,LOAD_G3D,main_t::READ_MAP);
+			return;
+		}
 		if(!ok || !bytes.size())
 			data_error("could not load");
-		if(LOAD_G3D == data) {
-			binary_reader_t in(bytes);
-			const uint32_t ver = in.uint32();
-			// note the endian here is little endian
-			if(((ver&0xff)!='G')||(((ver>>8)&0xff)!='3')||(((ver>>16)&0xff)!='D'))
-				data_error("(" << std::hex << ver << ") is not a G3D model");
-			switch(ver>>24) {
-			//case 3: {
-			//} break;
-			case 4: {
-				const uint16_t mesh_count = in.uint16();
-				if(!mesh_count) data_error("has no meshes");
-				if(in.byte()) data_error("not a G3D mtMorphMesh");
-				for(int16_t i=0; i<mesh_count; i++)
-					meshes.push_back(new mesh_t(*this,in,ver>>24));
-			} break;
-			default: data_error("not a supported G3D model version (" << (ver&0xff) << ")");
-			}
-		} else
+		if(LOAD_G3D == data || LOAD_G3DC == data)
+			main.get_jobs().submit(parsing = new parse_job_t(*this,bytes));
+		else
 			data_error("stray io " << name << ',' << data);
+	} catch(std::exception& e) {
+		std::cerr << "ERROR loading G3D " << filename << ": " << e.what() << std::endl;
+	}
+}
+
+void g3d_t::on_parsed(parse_job_t& job) {
+	parsing = NULL;
+	try {
+		if(job.error.size())
+			data_error(job.error);
+		for(g3d_data_t::meshes_t::iterator m=job.data.meshes.begin(); m!=job.data.meshes.end(); m++)
+			meshes.push_back(new mesh_t(*this,*m));
+		draw_order = meshes;
+		std::stable_sort(draw_order.begin(),draw_order.end(),by_program);
 	} catch(std::exception& e) {
 		std::cerr << "ERROR loading G3D " << filename << ": " << e.what() << std::endl;
 		meshes.clear();
-		ok = false;
+		draw_order.clear();
 	}
 }
 
-g3d_t::mesh_t::mesh_t(g3d_t& g,binary_reader_t& in,char ver):
+g3d_t::mesh_t::mesh_t(g3d_t& g,g3d_data_t::mesh_t& data):
 	g3d(g),
-	vn_data(NULL), t_data(NULL), i_data(NULL), vn_vbo(NULL), t_vbo(NULL), i_vbo(0),
-	texture(0), program(0),
-	min(FLT_MAX/2,FLT_MAX/2,FLT_MAX/2), max(-FLT_MAX/2,-FLT_MAX/2,-FLT_MAX/2) {
-	if(ver==4) {
-		name = std::string(in.fixed_str<64>().c_str());
-		frame_count = in.uint32(); if(!frame_count) data_error(name << " has no frames");
-		vertex_count = in.uint32(); if(!vertex_count) data_error(name << " has no vertices");
-		index_count = in.uint32(); if(!index_count) data_error(name << " has no indices");
-		if(index_count%3) data_error(name << " bad number of indices: " << index_count);
-		in.skip(9*4);
-		textures = in.uint32();
-		for(int t=0; t<5; t++)
-			if((1<<t)&textures) {
-				const std::string path = std::string(in.fixed_str<64>().c_str());
-				if(t==0) // diffuse?
-					g3d.main.load_texture(g3d.main.relpath(g3d.filename,path),this,LOAD_TEXTURE);
-			}
-		tex_frame_count = textures?1:0;
-	}
-	const size_t vn_size = vertex_count*frame_count*6;
-	vn_data = new GLfloat[vn_size];
-	for(int pass=0; pass<2; pass++) //0==vertices,1==normals
-		for(uint32_t f=0; f<frame_count; f++)
-			for(uint32_t v=0; v<vertex_count; v++)
-				for(int j=0; j<3; j++) {
-					const size_t slot = f*vertex_count*6 + v*6 + pass*3 + j;
-					assert(slot < vn_size);
-					vn_data[slot] = in.float32();
-					min[j] = std::min(vn_data[slot],min[j]);
-					max[j] = std::max(vn_data[slot],max[j]);
-				}
-	vn_vbo = new GLuint[frame_count];
-	glGenBuffers(frame_count,vn_vbo);
-	glCheck();
-	for(uint32_t f=0; f<frame_count; f++) {
-		glBindBuffer(GL_ARRAY_BUFFER,vn_vbo[f]);
-		glBufferData(GL_ARRAY_BUFFER,vertex_count*6*sizeof(GLfloat),vn_data+f*vertex_count*6,GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER,0);
-		glCheck();
-	}
-	const size_t texture_size = textures?tex_frame_count*vertex_count*2:0;
-	t_data = new GLfloat[texture_size];
-	for(uint32_t f=0; f<tex_frame_count; f++)
-		for(uint32_t v=0; v<vertex_count; v++) {
-			size_t slot = f*vertex_count*2+v*2;
-			assert(slot < texture_size-1);
-			t_data[slot] = in.float32();
-			t_data[slot+1] = 1.-in.float32(); // invert Y
+	frame_texture(0), frame_texture_width(0), frame_texture_height(0),
+	texture(0), program(0), instanced_program(0) {
+	swap(data);
+	if(diffuse.size())
+		g3d.main.load_texture(g3d.main.relpath(g3d.filename,diffuse),this,LOAD_TEXTURE);
+	if(g3d.vertex_format == QUANTISED_VERTICES) {
+		const g3d_data_t::quantised_t q(*this,supported_normal_format());
+		vn_stride = sizeof(g3d_data_t::quantised_t::vertex_t);
+		t_stride = 2*sizeof(GLushort);
+		vertex_type = tex_type = GL_UNSIGNED_SHORT;
+	#ifdef GL_INT_2_10_10_10_REV
+		if(q.normal_format == g3d_data_t::quantised_t::NORMAL_10_10_10_2) {
+			normal_type = GL_INT_2_10_10_10_REV;
+			normal_size = 4; // the packed type insists; the shader ignores w
+		} else
+	#endif
+		{
+			normal_type = GL_BYTE;
+			normal_size = 3;
 		}
-	t_vbo = new GLuint[tex_frame_count];
-	glGenBuffers(tex_frame_count,t_vbo);
-	glCheck();
-	for(uint32_t f=0; f<tex_frame_count; f++) {
-		glBindBuffer(GL_ARRAY_BUFFER,t_vbo[f]);
-		glBufferData(GL_ARRAY_BUFFER,vertex_count*2*sizeof(GLfloat),t_data+f*vertex_count*2,GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER,0);
-		glCheck();
-	}
-	i_data = new GLushort[index_count];
-	for(uint32_t i=0; i<index_count; i++) {
-		i_data[i] = in.uint32();
-		if(i_data[i] >= vertex_count)
-			data_error("index[" << i << "]=" << i_data[i] << " out of bounds (" << vertex_count << ')');
+		vertex_offset = q.vertex_offset;
+		vertex_scale = q.vertex_scale;
+		tex_offset = q.tex_offset;
+		tex_scale = q.tex_scale;
+		acquire_bufs(vn_bufs,frame_count,&q.vn_data[0],vertex_count*vn_stride);
+		acquire_bufs(t_bufs,tex_frame_count,tex_frame_count? &q.t_data[0]: NULL,vertex_count*t_stride);
+	} else {
+		vn_stride = 6*sizeof(GLfloat);
+		t_stride = 2*sizeof(GLfloat);
+		vertex_type = normal_type = tex_type = GL_FLOAT;
+		normal_size = 3;
+		vertex_offset = glm::vec3(0,0,0);
+		vertex_scale = glm::vec3(1,1,1);
+		tex_offset = glm::vec2(0,0);
+		tex_scale = glm::vec2(1,1);
+		// single frames gain nothing from a frame texture; their vertex input is already constant
+		if(!(g3d.vertex_format == FRAME_TEXTURES && frame_count > 1 && upload_frame_texture()))
+			acquire_bufs(vn_bufs,frame_count,vn(),vn_frame_size());
+		acquire_bufs(t_bufs,tex_frame_count,t(),t_frame_size());
 	}
-	glGenBuffers(1,&i_vbo);
-	glCheck();
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,i_vbo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,index_count*sizeof(GLushort),i_data,GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
-	glCheck();
-	if(1 == frame_count) {
-		program = g3d.main.get_shared_program("g3d_single_frame");
-		graphics_assert(program && "g3d_single_frame"); // provided by game adaptation
+	i_buf = g3d.main.get_asset_registry().acquire_buffer(GL_ELEMENT_ARRAY_BUFFER,i(),i_size());
+	lod_bufs.resize(lods.size());
+	for(size_t l=0; l<lods.size(); l++)
+		lod_bufs[l] = g3d.main.get_asset_registry().acquire_buffer(GL_ELEMENT_ARRAY_BUFFER,&lods[l].i_data[0],lods[l].i_size());
+	_stats.unpooled_buffers += frame_count + tex_frame_count + 1 + lods.size();
+	_stats.lod_bytes += lods_size();
+	_stats.gpu_bytes += gpu_bytes();
+	_stats.decimated_bytes += decimated_bytes();
+	if(frame_texture)
+		_stats.frame_texture_meshes++;
+	// cooked files were uploaded straight from the file bytes, which go away after on_io
+	if(g3d.residency == RETAIN_CPU_COPY) {
+		own_arrays();
+		_stats.cpu_bytes += array_bytes();
 	} else {
-		program = g3d.main.get_shared_program("g3d_multi_frame");
-		graphics_assert(program && "g3d_multi_frame"); // provided by game adaptation
+		free_arrays();
+		_stats.discarded_bytes += array_bytes();
+	}
+	if(frame_texture) {
+		program = g3d.main.get_shared_program("g3d_frame_texture");
+		graphics_assert(program && "g3d_frame_texture"); // upload_frame_texture() checked
 		uniform_lerp = g3d.main.get_uniform_loc(program,"LERP",GL_FLOAT);
-		attrib_vertex_1 = g3d.main.get_attribute_loc(program,"VERTEX_1",GL_FLOAT_VEC3);
-		attrib_normal_1 = g3d.main.get_attribute_loc(program,"NORMAL_1",GL_FLOAT_VEC3);
+		attribs.vertex_index = g3d.main.get_attribute_loc(program,"VERTEX_INDEX",GL_FLOAT);
+		uniform_frame_0 = g3d.main.get_uniform_loc(program,"FRAME_0",GL_FLOAT);
+		uniform_frame_1 = g3d.main.get_uniform_loc(program,"FRAME_1",GL_FLOAT);
+		uniform_frames_size = g3d.main.get_uniform_loc(program,"FRAMES_SIZE",GL_FLOAT_VEC2);
+	} else {
+		if(1 == frame_count) {
+			program = g3d.main.get_shared_program("g3d_single_frame");
+			graphics_assert(program && "g3d_single_frame"); // provided by game adaptation
+		} else {
+			program = g3d.main.get_shared_program("g3d_multi_frame");
+			graphics_assert(program && "g3d_multi_frame"); // provided by game adaptation
+			uniform_lerp = g3d.main.get_uniform_loc(program,"LERP",GL_FLOAT);
+			attribs.vertex_1 = g3d.main.get_attribute_loc(program,"VERTEX_1",GL_FLOAT_VEC3);
+			attribs.normal_1 = g3d.main.get_attribute_loc(program,"NORMAL_1",GL_FLOAT_VEC3);
+		}
+		attribs.vertex_0 = g3d.main.get_attribute_loc(program,"VERTEX_0",GL_FLOAT_VEC3);
+		attribs.normal_0 = g3d.main.get_attribute_loc(program,"NORMAL_0",GL_FLOAT_VEC3);
+		uniform_vertex_offset = g3d.main.get_uniform_loc(program,"VERTEX_OFFSET",GL_FLOAT_VEC3);
+		uniform_vertex_scale = g3d.main.get_uniform_loc(program,"VERTEX_SCALE",GL_FLOAT_VEC3);
+		uniform_tex_offset = g3d.main.get_uniform_loc(program,"TEX_OFFSET",GL_FLOAT_VEC2);
+		uniform_tex_scale = g3d.main.get_uniform_loc(program,"TEX_SCALE",GL_FLOAT_VEC2);
 	}
 	uniform_mvp_matrix = g3d.main.get_uniform_loc(program,"MVP_MATRIX",GL_FLOAT_MAT4);
 	uniform_normal_matrix = g3d.main.get_uniform_loc(program,"NORMAL_MATRIX",GL_FLOAT_MAT3);
 	uniform_light_0 = g3d.main.get_uniform_loc(program,"LIGHT_0",GL_FLOAT_VEC3);
 	uniform_colour = g3d.main.get_uniform_loc(program,"COLOUR",GL_FLOAT_VEC4);
-	attrib_vertex_0 = g3d.main.get_attribute_loc(program,"VERTEX_0",GL_FLOAT_VEC3);
-	attrib_normal_0 = g3d.main.get_attribute_loc(program,"NORMAL_0",GL_FLOAT_VEC3);
-	attrib_tex = g3d.main.get_attribute_loc(program,"TEX_COORD_0",GL_FLOAT_VEC2);
+	attribs.tex = g3d.main.get_attribute_loc(program,"TEX_COORD_0",GL_FLOAT_VEC2);
 	glUseProgram(program);
 	glCheck();
 	glUniform1i(g3d.main.get_uniform_loc(program,"TEX_UNIT_0"),0);
+	if(frame_texture)
+		glUniform1i(g3d.main.get_uniform_loc(program,"FRAMES"),1);
+	else if(instancing_supported()) // the game adaptation may provide instanced programs too
+		instanced_program = g3d.main.get_shared_program((1 == frame_count)? "g3d_single_frame_instanced": "g3d_multi_frame_instanced");
+	if(instanced_program) {
+		if(frame_count > 1) {
+			instanced_lerp = g3d.main.get_attribute_loc(instanced_program,"INSTANCE_LERP",GL_FLOAT);
+			instanced_attribs.vertex_1 = g3d.main.get_attribute_loc(instanced_program,"VERTEX_1",GL_FLOAT_VEC3);
+			instanced_attribs.normal_1 = g3d.main.get_attribute_loc(instanced_program,"NORMAL_1",GL_FLOAT_VEC3);
+		}
+		instanced_attribs.vertex_0 = g3d.main.get_attribute_loc(instanced_program,"VERTEX_0",GL_FLOAT_VEC3);
+		instanced_attribs.normal_0 = g3d.main.get_attribute_loc(instanced_program,"NORMAL_0",GL_FLOAT_VEC3);
+		instanced_attribs.tex = g3d.main.get_attribute_loc(instanced_program,"TEX_COORD_0",GL_FLOAT_VEC2);
+		instanced_mvp_matrix = g3d.main.get_attribute_loc(instanced_program,"INSTANCE_MVP_MATRIX",GL_FLOAT_MAT4);
+		instanced_normal_matrix = g3d.main.get_attribute_loc(instanced_program,"INSTANCE_NORMAL_MATRIX",GL_FLOAT_MAT3);
+		instanced_colour = g3d.main.get_attribute_loc(instanced_program,"INSTANCE_COLOUR",GL_FLOAT_VEC4);
+		instanced_light_0 = g3d.main.get_uniform_loc(instanced_program,"LIGHT_0",GL_FLOAT_VEC3);
+		instanced_vertex_offset = g3d.main.get_uniform_loc(instanced_program,"VERTEX_OFFSET",GL_FLOAT_VEC3);
+		instanced_vertex_scale = g3d.main.get_uniform_loc(instanced_program,"VERTEX_SCALE",GL_FLOAT_VEC3);
+		instanced_tex_offset = g3d.main.get_uniform_loc(instanced_program,"TEX_OFFSET",GL_FLOAT_VEC2);
+		instanced_tex_scale = g3d.main.get_uniform_loc(instanced_program,"TEX_SCALE",GL_FLOAT_VEC2);
+		glUseProgram(instanced_program);
+		glUniform1i(g3d.main.get_uniform_loc(instanced_program,"TEX_UNIT_0"),0);
+		glCheck();
+	}
 	if(!(textures&1))
 		g3d.on_ready(this);
 	glUseProgram(0);
 }
 
 g3d_t::mesh_t::~mesh_t() {
-	delete[] vn_data;
-	delete[] t_data;
-	if(vn_vbo) glDeleteBuffers(frame_count,vn_vbo);
-	delete[] vn_vbo;
-	if(t_vbo) glDeleteBuffers(tex_frame_count,t_vbo);
-	delete[] t_vbo;
-	delete[] i_data;
-	if(i_vbo) glDeleteBuffers(1,&i_vbo);
-}
-
-void g3d_t::mesh_t::draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light_0,bool cycles,const glm::vec4& colour) {
-	if(!i_vbo || ((textures&1) && !texture)) {
-		std::cerr << "cannot draw " << g3d.filename << ':' << name << " because it is not initialized (" << i_vbo << ',' << textures << ',' << texture << ')' << std::endl;
-		return;
+	g3d.main.cancel_load_texture(this,LOAD_TEXTURE);
+	if(g3d.residency == RETAIN_CPU_COPY)
+		_stats.cpu_bytes -= array_bytes();
+	else
+		_stats.discarded_bytes -= array_bytes();
+	release_gl();
+}
+
+void g3d_t::mesh_t::discard_cpu_copy() {
+	free_arrays();
+	_stats.cpu_bytes -= array_bytes();
+	_stats.discarded_bytes += array_bytes();
+}
+
+void g3d_t::mesh_t::release_gl() {
+	if(i_buf.buffer) {
+		_stats.unpooled_buffers -= frame_count + tex_frame_count + 1 + lods.size();
+		_stats.lod_bytes -= lods_size();
+		_stats.gpu_bytes -= gpu_bytes();
+		_stats.decimated_bytes -= decimated_bytes();
+		if(frame_texture)
+			_stats.frame_texture_meshes--;
+	}
+	asset_registry_t& registry = g3d.main.get_asset_registry();
+	for(bufs_t::iterator b=vn_bufs.begin(); b!=vn_bufs.end(); b++)
+		registry.release_buffer(GL_ARRAY_BUFFER,*b);
+	for(bufs_t::iterator b=t_bufs.begin(); b!=t_bufs.end(); b++)
+		registry.release_buffer(GL_ARRAY_BUFFER,*b);
+	registry.release_buffer(GL_ELEMENT_ARRAY_BUFFER,i_buf);
+	for(bufs_t::iterator b=lod_bufs.begin(); b!=lod_bufs.end(); b++)
+		registry.release_buffer(GL_ELEMENT_ARRAY_BUFFER,*b);
+	if(vertex_index_buf.buffer)
+		registry.release_buffer(GL_ARRAY_BUFFER,vertex_index_buf);
+	for(vertex_arrays_t::iterator va=vertex_arrays.begin(); va!=vertex_arrays.end(); va++)
+		g3d.main.get_gl_state().delete_vertex_array(va->second.vertex_array);
+	vertex_arrays.clear();
+	registry.release_texture(frame_texture);
+}
+
+// frames as a float texture of position and normal texels per vertex per frame, wrapped at FRAME_TEXTURE_WIDTH;
+// the vertex input is then each vertex's index, the same for every frame and shared by meshes of the same size.
+// Returns false, leaving the mesh to use per-frame buffers, if the GL or the game can't do it
+bool g3d_t::mesh_t::upload_frame_texture() {
+#ifdef __native_client__
+	return false;
+#else
+	static const bool supported = frame_textures_supported();
+	if(!supported || !g3d.main.get_shared_program("g3d_frame_texture"))
+		return false;
+	const size_t texels = (size_t)frame_count*vertex_count*2;
+	GLint max_size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE,&max_size);
+	frame_texture_width = FRAME_TEXTURE_WIDTH;
+	frame_texture_height = (texels+FRAME_TEXTURE_WIDTH-1)/FRAME_TEXTURE_WIDTH;
+	if(frame_texture_height > max_size || texels >= (1<<24)) // the shader's float maths is exact to 2^24
+		return false;
+	asset_registry_t& registry = g3d.main.get_asset_registry();
+	frame_texture = registry.acquire_texture(GL_RGB32F,vn(),frame_count*vn_frame_size());
+	if(!frame_texture) {
+		std::vector<GLfloat> padded(vn(),vn()+texels*3);
+		padded.resize(frame_texture_width*frame_texture_height*3);
+		glGenTextures(1,&frame_texture);
+		glBindTexture(GL_TEXTURE_2D,frame_texture);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D,0,GL_RGB32F,frame_texture_width,frame_texture_height,0,GL_RGB,GL_FLOAT,&padded[0]);
+		glBindTexture(GL_TEXTURE_2D,0);
+		glCheck();
+		registry.add_texture(GL_RGB32F,vn(),frame_count*vn_frame_size(),frame_texture);
+	}
+	std::vector<GLushort> indices(vertex_count);
+	for(uint32_t v=0; v<vertex_count; v++)
+		indices[v] = v;
+	vertex_index_buf = registry.acquire_buffer(GL_ARRAY_BUFFER,&indices[0],vertex_count*sizeof(GLushort));
+	return true;
+#endif
+}
+
+void g3d_t::mesh_t::acquire_bufs(bufs_t& bufs,size_t count,const void* data,size_t size) {
+	asset_registry_t& registry = g3d.main.get_asset_registry();
+	bufs.resize(count);
+	for(size_t i=0; i<count; i++)
+		bufs[i] = registry.acquire_buffer(GL_ARRAY_BUFFER,static_cast<const char*>(data)+i*size,size);
+}
+
+bool g3d_t::mesh_t::can_draw() const {
+	if(!i_buf.buffer || ((textures&1) && !texture)) {
+		std::cerr << "cannot draw " << g3d.filename << ':' << name << " because it is not initialized (" << i_buf.buffer << ',' << textures << ',' << texture << ')' << std::endl;
+		return false;
 	} else if(!frame_count) {
 		std::cerr << "cannot draw " << g3d.filename << ':' << name << " because it has no frames!" << std::endl;
-		return;
+		return false;
+	}
+	return true;
+}
+
+void g3d_t::mesh_t::draw(float time,bool cycles,const glm::mat4& mvp,const glm::vec4& colour) {
+	uint32_t frame_0, frame_1;
+	float lerp;
+	frames_at(time,cycles,frame_0,frame_1,lerp);
+	const size_t level = lod_level(mvp);
+	const buffer_arena_t::alloc_t& indices = level? lod_bufs[level-1]: i_buf;
+	const uint32_t draw_count = level? lods[level-1].index_count: index_count;
+	count_draw(level);
+	gl_state_t& gl = g3d.main.get_gl_state();
+	if(lod_debug_colours) {
+		glm::vec4 tint(colour*LOD_COLOURS[level]);
+		glUniform4fv(uniform_colour,1,glm::value_ptr(tint));
+		_stats.uniform_uploads++;
+	}
+	if(frame_texture) {
+		// the vertex input is the same whatever the frame; only uniforms choose it
+		glUniform2f(uniform_frames_size,frame_texture_width,frame_texture_height);
+		glUniform1f(uniform_frame_0,(float)frame_0*vertex_count*2);
+		glUniform1f(uniform_frame_1,(float)frame_1*vertex_count*2);
+		glUniform1f(uniform_lerp,lerp);
+		_stats.uniform_uploads += 4;
+		gl.bind_texture(1,frame_texture);
+		frame_0 = frame_1 = 0;
+	} else {
+		if(g3d.vertex_format == QUANTISED_VERTICES) { // else g3d_t::draw() set the identity
+			glUniform3fv(uniform_vertex_offset,1,glm::value_ptr(vertex_offset));
+			glUniform3fv(uniform_vertex_scale,1,glm::value_ptr(vertex_scale));
+			glUniform2fv(uniform_tex_offset,1,glm::value_ptr(tex_offset));
+			glUniform2fv(uniform_tex_scale,1,glm::value_ptr(tex_scale));
+			_stats.uniform_uploads += 4;
+		}
+		if(frame_count > 1) {
+			glUniform1f(uniform_lerp,lerp);
+			_stats.uniform_uploads++;
+		} else
+			frame_1 = 0;
 	}
-	const uint32_t frame_count = ((this->frame_count > 1) && !cycles)? this->frame_count-1: this->frame_count; 
-	time = std::min(std::max(time,0.0f),1.0f) * (float)frame_count;
-	const size_t frame_0 = (size_t)time % frame_count;
-	glUseProgram(program);
-	glCheck();
-	glUniform4fv(uniform_colour,1,glm::value_ptr(const_cast<glm::vec4&>(colour)));
-	glUniform3fv(uniform_light_0,1,glm::value_ptr(const_cast<glm::vec3&>(light_0)));
-	glUniformMatrix4fv(uniform_mvp_matrix,1,false,glm::value_ptr(projection*modelview));
-	glUniformMatrix3fv(uniform_normal_matrix,1,false,glm::value_ptr(glm::inverse(glm::mat3(modelview))));
 	glCheck();
-	const GLsizei stride = 6*sizeof(GLfloat);
-	glBindBuffer(GL_ARRAY_BUFFER,vn_vbo[frame_0]);	
-	glVertexAttribPointer(attrib_vertex_0,3,GL_FLOAT,GL_FALSE,stride,(void*)(0));
-	glEnableVertexAttribArray(attrib_vertex_0);
-	glVertexAttribPointer(attrib_normal_0,3,GL_FLOAT,GL_FALSE,stride,(void*)(3*sizeof(GLfloat)));
-	glEnableVertexAttribArray(attrib_normal_0);
+	gl.bind_texture(0,texture);
+	const size_t tex_frame = tex_frame_at(time);
+	if(use_vertex_arrays && gl_state_t::vertex_arrays_supported()) {
+		vertex_array_t& va = vertex_array(frame_0,frame_1,tex_frame);
+		gl.bind_vertex_array(va.vertex_array,va.element_buffer);
+		g3d.bind_buffer(GL_ELEMENT_ARRAY_BUFFER,indices.buffer);
+		va.element_buffer = indices.buffer; // the binding is the vertex array's
+	} else {
+		gl.bind_vertex_array(0); // pointers set are the bound vertex array's
+		gl.use_attribs(point_attribs(attribs,frame_0,frame_1,tex_frame));
+		g3d.bind_buffer(GL_ELEMENT_ARRAY_BUFFER,indices.buffer);
+	}
+	gl.draw_elements(GL_TRIANGLES,draw_count,GL_UNSIGNED_SHORT,indices.ptr());
+	glCheck(); // everything is left bound for the next mesh, which is likely to want much of it
+}
+
+void g3d_t::mesh_t::draw_instanced(const instances_t& instances,const glm::mat4* mvps,const instance_data_t* per_instance,bool cycles,const glm::vec3& light_0) {
+	// group the instances by pose and level of detail
+	typedef std::pair<uint64_t,size_t> pose_t; // frame_0, frame_1 and tex_frame as vertex arrays are keyed; level
+	typedef std::vector<std::pair<size_t,float> > posed_t; // instance, lerp
+	typedef std::map<pose_t,posed_t> poses_t;
+	poses_t poses;
+	for(size_t i=0; i<instances.size(); i++) {
+		uint32_t frame_0, frame_1;
+		float lerp;
+		frames_at(instances[i].time,cycles,frame_0,frame_1,lerp);
+		if(frame_count < 2) frame_1 = 0;
+		const uint64_t key = ((uint64_t)frame_0<<40) | ((uint64_t)frame_1<<20) | tex_frame_at(instances[i].time);
+		poses[pose_t(key,lod_level(mvps[i]))].push_back(std::make_pair(i,lerp));
+	}
+	std::vector<instance_data_t> data;
+	data.reserve(instances.size());
+	for(poses_t::const_iterator p=poses.begin(); p!=poses.end(); p++)
+		for(posed_t::const_iterator i=p->second.begin(); i!=p->second.end(); i++) {
+			data.push_back(per_instance[i->first]);
+			data.back().lerp = i->second;
+			if(lod_debug_colours)
+				for(int c=0; c<4; c++)
+					data.back().colour[c] *= LOD_COLOURS[p->first.second][c];
+		}
+	gl_state_t& gl = g3d.main.get_gl_state();
+	const GLuint instance_buffer = gl.instance_buffer();
+	g3d.bind_buffer(GL_ARRAY_BUFFER,instance_buffer);
+	glBufferData(GL_ARRAY_BUFFER,data.size()*sizeof(instance_data_t),&data[0],GL_STREAM_DRAW); // orphans the last
+	gl.use_program(instanced_program);
+	glm::vec3 light(light_0);
+	glUniform3fv(instanced_light_0,1,glm::value_ptr(light));
+	glUniform3fv(instanced_vertex_offset,1,glm::value_ptr(vertex_offset));
+	glUniform3fv(instanced_vertex_scale,1,glm::value_ptr(vertex_scale));
+	glUniform2fv(instanced_tex_offset,1,glm::value_ptr(tex_offset));
+	glUniform2fv(instanced_tex_scale,1,glm::value_ptr(tex_scale));
+	_stats.uniform_uploads += 5;
 	glCheck();
-	if(frame_count > 1) {
-		const size_t frame_1 = (frame_0+1) % this->frame_count;
-		const float lerp = fmod(time,1);
-		glUniform1f(uniform_lerp,lerp);
-		glBindBuffer(GL_ARRAY_BUFFER,vn_vbo[frame_1]);	
-		glVertexAttribPointer(attrib_vertex_1,3,GL_FLOAT,GL_FALSE,stride,(void*)(0));
-		glEnableVertexAttribArray(attrib_vertex_1);
-		glVertexAttribPointer(attrib_normal_1,3,GL_FLOAT,GL_FALSE,stride,(void*)(3*sizeof(GLfloat)));
-		glEnableVertexAttribArray(attrib_normal_1);
-		glBindBuffer(GL_ARRAY_BUFFER,0);
+	gl.bind_texture(0,texture);
+	gl.bind_vertex_array(0); // pointers set are the bound vertex array's
+	const GLsizei stride = sizeof(instance_data_t);
+	size_t first = 0;
+	for(poses_t::const_iterator p=poses.begin(); p!=poses.end(); p++) {
+		const uint32_t frame_0 = p->first.first>>40, frame_1 = (p->first.first>>20)&0xfffff;
+		const size_t tex_frame = p->first.first&0xfffff, level = p->first.second, count = p->second.size();
+		const uint32_t mask = point_attribs(instanced_attribs,frame_0,frame_1,tex_frame);
+		g3d.bind_buffer(GL_ARRAY_BUFFER,instance_buffer);
+		const char* const base = reinterpret_cast<const char*>(first*stride);
+		uint32_t instanced = 0;
+		for(GLuint c=0; c<4; c++) { // a matrix attribute is a vector per column
+			glVertexAttribPointer(instanced_mvp_matrix+c,4,GL_FLOAT,GL_FALSE,stride,base+offsetof(instance_data_t,mvp_matrix)+c*4*sizeof(GLfloat));
+			instanced |= gl_state_t::attrib_bit(instanced_mvp_matrix+c);
+		}
+		for(GLuint c=0; c<3; c++) {
+			glVertexAttribPointer(instanced_normal_matrix+c,3,GL_FLOAT,GL_FALSE,stride,base+offsetof(instance_data_t,normal_matrix)+c*3*sizeof(GLfloat));
+			instanced |= gl_state_t::attrib_bit(instanced_normal_matrix+c);
+		}
+		if(frame_count > 1) {
+			glVertexAttribPointer(instanced_lerp,1,GL_FLOAT,GL_FALSE,stride,base+offsetof(instance_data_t,lerp));
+			instanced |= gl_state_t::attrib_bit(instanced_lerp);
+		}
+		glVertexAttribPointer(instanced_colour,4,GL_FLOAT,GL_FALSE,stride,base+offsetof(instance_data_t,colour));
+		instanced |= gl_state_t::attrib_bit(instanced_colour);
 		glCheck();
+		gl.use_attribs(mask,instanced);
+		const buffer_arena_t::alloc_t& indices = level? lod_bufs[level-1]: i_buf;
+		g3d.bind_buffer(GL_ELEMENT_ARRAY_BUFFER,indices.buffer);
+		gl.draw_elements_instanced(GL_TRIANGLES,level? lods[level-1].index_count: index_count,GL_UNSIGNED_SHORT,indices.ptr(),count);
+		glCheck();
+		count_draw(level,count);
+		_stats.instanced_draws++;
+		first += count;
+	}
+}
+
+// the coarsest level that, this size on screen, is off by no more than lod_pixel_error; 0 is the full mesh
+size_t g3d_t::mesh_t::lod_level(const glm::mat4& mvp) const {
+	size_t level = 0;
+	if(lods.size()) {
+		const float pixels = pixels_per_unit(mvp);
+		while(level < lods.size() && lods[level].error*pixels <= lod_pixel_error)
+			level++;
+	}
+	return level;
+}
+
+size_t g3d_t::mesh_t::tex_frame_at(float time) const {
+	if(!(textures&1) || !texture) return 0;
+	return (size_t)(std::min(std::max(time,0.0f),1.0f) * (float)tex_frame_count) % tex_frame_count;
+}
+
+void g3d_t::mesh_t::count_draw(size_t level,size_t instances) {
+	if(level) {
+		_stats.lod_draws += instances;
+		_stats.lod_triangles_saved += instances*((index_count-lods[level-1].index_count)/3);
+	}
+	_stats.mesh_draws += instances;
+	// what separate per-frame buffers cost: bind frame 0, frame 1 and UVs (each then unbound), and indices
+	_stats.unpooled_buffer_binds += instances*(2 + (frame_count>1? 2: 0) + ((textures&1)? 2: 0));
+	// what setting everything for each mesh costs: colour, light, both matrices and the mesh's own
+	_stats.unshared_uniform_uploads += instances*(4 + 4 + ((!frame_texture && frame_count > 1)? 1: 0));
+}
+
+uint32_t g3d_t::mesh_t::point_attribs(const attribs_t& locations,uint32_t frame_0,uint32_t frame_1,size_t tex_frame) {
+	const GLboolean normalised = (vertex_type != GL_FLOAT);
+	uint32_t mask = 0;
+	if(frame_texture) {
+		g3d.bind_buffer(GL_ARRAY_BUFFER,vertex_index_buf.buffer);
+		glVertexAttribPointer(locations.vertex_index,1,GL_UNSIGNED_SHORT,GL_FALSE,0,vertex_index_buf.ptr());
+		mask |= gl_state_t::attrib_bit(locations.vertex_index);
+		glCheck();
+	} else {
+		// frames, UVs and indices are usually all in the same arena page, so binds are rare
+		const GLsizei normal_ofs = (vertex_type == GL_FLOAT)? 3*sizeof(GLfloat): offsetof(g3d_data_t::quantised_t::vertex_t,normal);
+		const buffer_arena_t::alloc_t& vn_0 = vn_bufs[frame_0];
+		g3d.bind_buffer(GL_ARRAY_BUFFER,vn_0.buffer);
+		glVertexAttribPointer(locations.vertex_0,3,vertex_type,normalised,vn_stride,vn_0.ptr());
+		glVertexAttribPointer(locations.normal_0,normal_size,normal_type,normalised,vn_stride,vn_0.ptr(normal_ofs));
+		mask |= gl_state_t::attrib_bit(locations.vertex_0) | gl_state_t::attrib_bit(locations.normal_0);
+		glCheck();
+		if(frame_count > 1) {
+			const buffer_arena_t::alloc_t& vn_1 = vn_bufs[frame_1];
+			g3d.bind_buffer(GL_ARRAY_BUFFER,vn_1.buffer);
+			glVertexAttribPointer(locations.vertex_1,3,vertex_type,normalised,vn_stride,vn_1.ptr());
+			glVertexAttribPointer(locations.normal_1,normal_size,normal_type,normalised,vn_stride,vn_1.ptr(normal_ofs));
+			mask |= gl_state_t::attrib_bit(locations.vertex_1) | gl_state_t::attrib_bit(locations.normal_1);
+			glCheck();
+		}
 	}
-	glBindTexture(GL_TEXTURE_2D,texture);
 	if((textures&1) && texture) {
-		const size_t tex_frame = (size_t)(std::min(std::max(time,0.0f),1.0f) * (float)tex_frame_count) % tex_frame_count;
-		glBindBuffer(GL_ARRAY_BUFFER,t_vbo[tex_frame]);
-		glVertexAttribPointer(attrib_tex,2,GL_FLOAT,GL_FALSE,2*sizeof(GLfloat),(void*)(0));
-		glEnableVertexAttribArray(attrib_tex);
-		glBindBuffer(GL_ARRAY_BUFFER,0);
+		g3d.bind_buffer(GL_ARRAY_BUFFER,t_bufs[tex_frame].buffer);
+		glVertexAttribPointer(locations.tex,2,tex_type,normalised,t_stride,t_bufs[tex_frame].ptr());
+		mask |= gl_state_t::attrib_bit(locations.tex);
 		glCheck();
 	}
-	graphics_assert(i_vbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,i_vbo);
-	glDrawElements(GL_TRIANGLES,index_count,GL_UNSIGNED_SHORT,(void*)(0));
+	return mask;
+}
+
+g3d_t::mesh_t::vertex_array_t& g3d_t::mesh_t::vertex_array(uint32_t frame_0,uint32_t frame_1,size_t tex_frame) {
+	const uint64_t key = ((uint64_t)frame_0<<40) | ((uint64_t)frame_1<<20) | tex_frame;
+	vertex_arrays_t::iterator va = vertex_arrays.find(key);
+	if(va != vertex_arrays.end())
+		return va->second;
+	vertex_array_t& made = vertex_arrays[key];
+#ifndef __native_client__
+	glGenVertexArrays(1,&made.vertex_array);
 	glCheck();
-	glDisableVertexAttribArray(attrib_vertex_0);
-	glDisableVertexAttribArray(attrib_normal_0);
-	if(frame_count > 1) {
-		glDisableVertexAttribArray(attrib_vertex_1);
-		glDisableVertexAttribArray(attrib_normal_1);
-	}
-	if((textures&1) & texture) {
-		glDisableVertexAttribArray(attrib_tex);
-		glBindTexture(GL_TEXTURE_2D,0);
-	}
+	gl_state_t& gl = g3d.main.get_gl_state();
+	gl.bind_vertex_array(made.vertex_array);
+	const uint32_t mask = point_attribs(attribs,frame_0,frame_1,tex_frame);
+	for(GLuint location=0; location<32; location++)
+		if(mask & (1U<<location))
+			glEnableVertexAttribArray(location);
 	glCheck();
+#endif
+	return made;
+}
+
+// how many pixels a model unit at the middle of the mesh covers, along whichever model axis is longest on screen
+float g3d_t::mesh_t::pixels_per_unit(const glm::mat4& mvp) const {
+	const glm::vec3 centre((min+max)*0.5f);
+	const float w = mvp[0][3]*centre.x + mvp[1][3]*centre.y + mvp[2][3]*centre.z + mvp[3][3]; // 1 with an ortho projection
+	if(!(w > 0)) return FLT_MAX; // at or behind the eye; draw it whole
+	float longest = 0;
+	for(int axis=0; axis<3; axis++)
+		longest = std::max(longest,glm::length(glm::vec2(mvp[axis][0]*g3d.main.w(),mvp[axis][1]*g3d.main.h())));
+	return longest/(2*w);
 }
 
 void g3d_t::mesh_t::on_texture_loaded(const std::string& name,GLuint handle,intptr_t data) {
@@ -242,9 +668,81 @@ void g3d_t::mesh_t::on_texture_loaded(const std::string& name,GLuint handle,intp
 	g3d.on_ready(this);
 }
 
+bool g3d_t::by_program(const mesh_t* a,const mesh_t* b) {
+	return a->program < b->program;
+}
+
 void g3d_t::draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light_0,bool cycles,const glm::vec4& colour) {
-	for(meshes_t::iterator m=meshes.begin(); m!=meshes.end(); m++)
-		(*m)->draw(time,projection,modelview,light_0,cycles,colour);
+	const uint64_t start = high_precision_time();
+	// every mesh shares the transform, light and colour, so they are set once for each program the meshes use
+	glm::mat4 mvp(projection*modelview);
+	glm::mat3 normal_matrix(glm::inverse(glm::mat3(modelview)));
+	_stats.matrix_inversions++;
+	glm::vec3 light(light_0);
+	glm::vec4 tint(colour);
+	glm::vec3 zero(0,0,0), one(1,1,1);
+	glm::vec2 zero_2(0,0), one_2(1,1);
+	gl_state_t& gl = main.get_gl_state();
+	GLuint program = 0;
+	for(meshes_t::iterator m=draw_order.begin(); m!=draw_order.end(); m++) {
+		mesh_t& mesh = **m;
+		if(!mesh.can_draw()) continue;
+		if(mesh.program != program) {
+			program = mesh.program;
+			gl.use_program(program);
+			glUniform4fv(mesh.uniform_colour,1,glm::value_ptr(tint));
+			glUniform3fv(mesh.uniform_light_0,1,glm::value_ptr(light));
+			glUniformMatrix4fv(mesh.uniform_mvp_matrix,1,false,glm::value_ptr(mvp));
+			glUniformMatrix3fv(mesh.uniform_normal_matrix,1,false,glm::value_ptr(normal_matrix));
+			_stats.uniform_uploads += 4;
+			if(!mesh.frame_texture && vertex_format != QUANTISED_VERTICES) {
+				glUniform3fv(mesh.uniform_vertex_offset,1,glm::value_ptr(zero));
+				glUniform3fv(mesh.uniform_vertex_scale,1,glm::value_ptr(one));
+				glUniform2fv(mesh.uniform_tex_offset,1,glm::value_ptr(zero_2));
+				glUniform2fv(mesh.uniform_tex_scale,1,glm::value_ptr(one_2));
+				_stats.uniform_uploads += 4;
+			}
+			glCheck();
+		}
+		mesh.draw(time,cycles,mvp,colour);
+	}
+	_stats.object_draws++;
+	_stats.draw_ns += high_precision_time()-start;
+}
+
+void g3d_t::draw(const instances_t& instances,const glm::mat4& projection,const glm::vec3& light_0,bool cycles) {
+	bool instanced = use_instancing && (instances.size() > 1) && instancing_supported();
+	for(meshes_t::const_iterator m=draw_order.begin(); instanced && m!=draw_order.end(); m++)
+		instanced = (*m)->instanced_program;
+	if(!instanced) {
+		for(instances_t::const_iterator i=instances.begin(); i!=instances.end(); i++)
+			draw(i->time,projection,i->modelview,light_0,cycles,i->colour);
+		return;
+	}
+	const uint64_t start = high_precision_time();
+	// the transforms are the same for every mesh
+	std::vector<glm::mat4> mvps(instances.size());
+	std::vector<instance_data_t> per_instance(instances.size());
+	for(size_t i=0; i<instances.size(); i++) {
+		mvps[i] = projection*instances[i].modelview;
+		glm::mat3 normal_matrix(glm::inverse(glm::mat3(instances[i].modelview)));
+		glm::vec4 colour(instances[i].colour);
+		memcpy(per_instance[i].mvp_matrix,glm::value_ptr(mvps[i]),sizeof(per_instance[i].mvp_matrix));
+		memcpy(per_instance[i].normal_matrix,glm::value_ptr(normal_matrix),sizeof(per_instance[i].normal_matrix));
+		memcpy(per_instance[i].colour,glm::value_ptr(colour),sizeof(per_instance[i].colour));
+		per_instance[i].lerp = 0;
+	}
+	_stats.matrix_inversions += instances.size();
+	for(meshes_t::iterator m=draw_order.begin(); m!=draw_order.end(); m++)
+		if((*m)->can_draw())
+			(*m)->draw_instanced(instances,&mvps[0],&per_instance[0],cycles,light_0);
+	_stats.object_draws += instances.size();
+	_stats.draw_ns += high_precision_time()-start;
+}
+
+void g3d_t::bind_buffer(GLenum target,GLuint buffer) {
+	if(main.get_gl_state().bind_buffer(target,buffer))
+		_stats.buffer_binds++;
 }
 
 void g3d_t::bounds(glm::vec3& min,glm::vec3& max) {
@@ -256,6 +754,51 @@ void g3d_t::bounds(glm::vec3& min,glm::vec3& max) {
 	}
 }
 
+void g3d_t::bounds(float time,bool cycles,glm::vec3& min,glm::vec3& max) {
+	min = glm::vec3(FLT_MAX,FLT_MAX,FLT_MAX);
+	max = glm::vec3(-FLT_MAX,-FLT_MAX,-FLT_MAX);
+	for(meshes_t::const_iterator m=meshes.begin(); m!=meshes.end(); m++) {
+		const mesh_t& mesh = **m;
+		if(!mesh.frame_count) continue;
+		// a lerp between two frames stays within the union of their boxes
+		uint32_t frame_0, frame_1;
+		float lerp;
+		mesh.frames_at(time,cycles,frame_0,frame_1,lerp);
+		min = glm::min(min,glm::min(mesh.frame_min[frame_0],mesh.frame_min[frame_1]));
+		max = glm::max(max,glm::max(mesh.frame_max[frame_0],mesh.frame_max[frame_1]));
+	}
+}
+
+const g3d_data_t::mesh_t& g3d_t::cpu_mesh(size_t i) const {
+	if(residency != RETAIN_CPU_COPY)
+		panic(filename << " was loaded without a CPU copy");
+	return *meshes.at(i);
+}
+
+GLuint g3d_t::mesh_texture(size_t i) const {
+	const mesh_t& mesh = *meshes.at(i);
+	return (mesh.textures&1)? mesh.texture: 0;
+}
+
+bool g3d_t::is_static() const {
+	for(meshes_t::const_iterator m=meshes.begin(); m!=meshes.end(); m++)
+		if((*m)->frame_count != 1 || (*m)->tex_frame_count > 1)
+			return false;
+	return true;
+}
+
+void g3d_t::discard_cpu_copy() {
+	if(residency != RETAIN_CPU_COPY) return;
+	for(meshes_t::iterator m=meshes.begin(); m!=meshes.end(); m++)
+		(*m)->discard_cpu_copy();
+	residency = DISCARD_CPU_COPY;
+}
+
+void g3d_t::release_gl() {
+	for(meshes_t::iterator m=meshes.begin(); m!=meshes.end(); m++)
+		(*m)->release_gl();
+}
+
 bool g3d_t::is_ready() const {
 	for(meshes_t::const_iterator m=meshes.begin(); m!=meshes.end(); m++)
 		if(!(*m)->is_ready())
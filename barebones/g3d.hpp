@@ -5,44 +5,229 @@
 #include "../external/ogl-math/glm/glm.hpp"
 #include "../external/ogl-math/glm/gtc/type_ptr.hpp"
 
+#include <cstring>
+
 class binary_reader_t;
 
+// the CPU-side contents of a G3D file; no GL calls, so offline tools can link it.
+// Loads G3D v4 and our own cooked format, which is laid out ready for glBufferData
+struct g3d_data_t {
+	struct cache_stats_t {
+		float acmr; // vertex transforms per triangle; 0.5 is ideal, 3 is no reuse at all
+		float atvr; // vertex transforms per referenced vertex; 1 is ideal
+	};
+	enum { VERTEX_CACHE_SIZE = 16 }; // a FIFO the size of the older GPUs we still run on
+	struct mesh_t {
+		mesh_t();
+		std::string name, diffuse; // diffuse is the texture path as written in the file, or empty
+		uint32_t frame_count, vertex_count, index_count, textures, tex_frame_count;
+		glm::vec3 min, max; // over all frames, normals included
+		std::vector<glm::vec3> frame_min, frame_max; // per frame, positions only
+		// after decimation, the source frame each remaining frame was; empty if none were dropped.
+		// The first and last source frames are always kept
+		std::vector<uint32_t> key_frames;
+		uint32_t source_frame_count() const { return key_frames.size()? key_frames.back()+1: frame_count; }
+		// find the frames to lerp between at source frame time t, in [0,source_frame_count())
+		void key_frames_at(float t,uint32_t& frame_0,uint32_t& frame_1,float& lerp) const;
+		// ...or at normalised animation time, as g3d_t::draw() takes it
+		void frames_at(float time,bool cycles,uint32_t& frame_0,uint32_t& frame_1,float& lerp) const;
+		// the arrays are either owned by the mesh or, for cooked files, point straight into the file bytes
+		const GLfloat* vn() const { return vn_ext? vn_ext: vn_data.size()? &vn_data[0]: NULL; } // per frame, per vertex: x,y,z,nx,ny,nz
+		const GLfloat* t() const { return t_ext? t_ext: t_data.size()? &t_data[0]: NULL; } // per tex frame, per vertex: u,v with v already inverted
+		const GLushort* i() const { return i_ext? i_ext: i_data.size()? &i_data[0]: NULL; }
+		size_t vn_frame_size() const { return vertex_count*6*sizeof(GLfloat); }
+		size_t t_frame_size() const { return vertex_count*2*sizeof(GLfloat); }
+		size_t i_size() const { return index_count*sizeof(GLushort); }
+		std::vector<GLfloat> vn_data;
+		std::vector<GLfloat> t_data;
+		std::vector<GLushort> i_data;
+		// coarser index arrays over the same vertices, so every frame and tex frame still applies
+		struct lod_t {
+			lod_t(): error(0), index_count(0) {}
+			float error; // in model units, in the worst frame
+			uint32_t index_count;
+			std::vector<GLushort> i_data; // freed with the other arrays
+			size_t i_size() const { return index_count*sizeof(GLushort); }
+		};
+		typedef std::vector<lod_t> lods_t;
+		lods_t lods; // finest first; the full mesh is not among them
+		size_t lods_size() const;
+		const GLfloat* vn_ext;
+		const GLfloat* t_ext;
+		const GLushort* i_ext;
+		void swap(mesh_t& other);
+		size_t array_bytes() const { return frame_count*vn_frame_size() + tex_frame_count*t_frame_size() + i_size() + lods_size(); }
+		void own_arrays(); // copies arrays that point into file bytes so they outlive them
+		void free_arrays(); // all that remains is the counts, names and bounds
+		void optimise(); // reorder triangles for the post-transform cache and vertices by first use; owns the arrays
+		cache_stats_t cache_stats(size_t cache_size=VERTEX_CACHE_SIZE) const;
+		// drop frames that lerping their neighbours reproduces to within max_error of the
+		// mesh's extent (and a fixed bound on normals); returns how many were dropped
+		uint32_t decimate(float max_error);
+		// fill lods by collapsing edges until the error in any frame would pass max_error of the
+		// mesh's extent, halving the triangles each level; returns how many levels were made
+		uint32_t build_lods(float max_error);
+		enum { MAX_LODS = 4, MIN_LOD_TRIANGLES = 16 };
+	};
+	// positions as unsigned 16-bit normalised across the mesh's position bounds,
+	// normals as signed normalised 10-10-10-2 (or bytes, where GL lacks that) and
+	// UVs as unsigned 16-bit normalised across the UV bounds; 12 bytes/vertex/frame instead of 24
+	struct quantised_t {
+		enum normal_format_t { NORMAL_10_10_10_2, NORMAL_BYTE };
+		struct vertex_t {
+			GLushort x, y, z, pad;
+			uint32_t normal;
+		};
+		quantised_t(const mesh_t& mesh,normal_format_t normal_format);
+		const normal_format_t normal_format;
+		glm::vec3 vertex_offset, vertex_scale; // dequantised = offset + scale * (q/65535)
+		glm::vec2 tex_offset, tex_scale;
+		std::vector<vertex_t> vn_data; // per frame, per vertex
+		std::vector<GLushort> t_data; // per tex frame, per vertex: u,v
+		// the loss, ignoring non-finite input
+		float max_vertex_error, rms_vertex_error; // in model units
+		float max_normal_error; // per component
+		float max_tex_error; // in UV units
+	};
+	typedef std::vector<mesh_t> meshes_t;
+	meshes_t meshes;
+	bool cooked; // were we loaded from a cooked file?
+	bool optimised; // are all the meshes in cache order?
+	g3d_data_t(): cooked(false), optimised(false) {}
+	// throws data_error_t; a cooked file's bytes must outlive us.
+	// Meshes are optimised unless told not to or the file was cooked already optimised
+	void load(binary_reader_t& in,bool optimise=true);
+	static void load_mesh(mesh_t& mesh,binary_reader_t& in,char ver);
+	std::string cook() const; // serialise in the cooked format
+	enum { COOKED_VERSION = 4 };
+private:
+	static void load_cooked_mesh(mesh_t& mesh,binary_reader_t& in,uint32_t ver);
+};
+
 class g3d_t: private main_t::file_io_t {
 public:
 	struct loaded_t {
 		virtual void on_g3d_loaded(g3d_t& g3d,bool ok,intptr_t data) = 0; // throw error if upset
 	};
-	g3d_t(main_t& main,const std::string& filename,loaded_t* observer=NULL,intptr_t data=0);
+	enum residency_t {
+		DISCARD_CPU_COPY, // vertex, UV and index arrays are freed once uploaded
+		RETAIN_CPU_COPY // for users that read them back, e.g. editor picking
+	};
+	enum vertex_format_t {
+		FLOAT_VERTICES,
+		QUANTISED_VERTICES, // see g3d_data_t::quantised_t; half the GL memory per frame
+		// animated meshes keep every frame in a float texture the vertex shader fetches from,
+		// so their vertex inputs don't change with the frame; float vertices where unsupported
+		FRAME_TEXTURES
+	};
+	static bool frame_textures_supported(); // float textures and vertex texture fetch
+	// max_frame_error, if non-zero, decimates frames as they load; see g3d_data_t::mesh_t::decimate().
+	// lod_error, if non-zero, builds levels of detail for meshes not cooked with them; see build_lods()
+	g3d_t(main_t& main,const std::string& filename,loaded_t* observer=NULL,intptr_t data=0,
+		residency_t residency=DISCARD_CPU_COPY,vertex_format_t vertex_format=FLOAT_VERTICES,float max_frame_error=0,float lod_error=0);
+	~g3d_t(); // cancels loading, and waits if a worker is parsing us
 	main_t& main;
 	const std::string filename;
+	residency_t residency; // only ever changed by discard_cpu_copy()
+	const vertex_format_t vertex_format;
+	const float max_frame_error;
+	const float lod_error;
+	static float lod_pixel_error; // draw() picks the coarsest level that is off by no more than this many pixels
+	static bool lod_debug_colours; // tint meshes by the level drawn: none, green, yellow, orange, red
+	static bool use_cooked; // load filename+"c", as written by "make cook", in preference where there is one; it isn't checked for staleness
+	// draw each pose from a vertex array object made the first time it is drawn, where the GL has them (not GLES2);
+	// off by default, as the one driver measured (llvmpipe) drew slower with them
+	static bool use_vertex_arrays;
+	static bool instancing_supported(); // GL 3.3; not GLES2
+	static bool use_instancing; // draw(instances) makes instanced draws where supported and the programs are provided
+	size_t mesh_count() const { return meshes.size(); }
+	const g3d_data_t::mesh_t& cpu_mesh(size_t i) const; // RETAIN_CPU_COPY only
+	GLuint mesh_texture(size_t i) const; // the diffuse texture, or 0 if none
+	bool is_static() const; // every mesh has one frame and at most one UV set, so every pose is the same
+	struct stats_t { // over all live models
+		stats_t(): cpu_bytes(0), gpu_bytes(0), discarded_bytes(0), decimated_bytes(0), unpooled_buffers(0), frame_texture_meshes(0), lod_bytes(0), mesh_draws(0), buffer_binds(0), unpooled_buffer_binds(0), lod_draws(0), lod_triangles_saved(0), object_draws(0), draw_ns(0), matrix_inversions(0), uniform_uploads(0), unshared_uniform_uploads(0), instanced_draws(0) {}
+		size_t cpu_bytes, gpu_bytes, discarded_bytes; // discarded_bytes is what DISCARD_CPU_COPY saved
+		size_t decimated_bytes; // GL bytes the dropped frames would have taken
+		size_t unpooled_buffers; // buffer objects there would be without the buffer arena
+		size_t frame_texture_meshes; // animated from frame textures
+		size_t lod_bytes; // GL bytes of the coarser index arrays
+		size_t mesh_draws, buffer_binds, unpooled_buffer_binds; // since reset_draw_stats()
+		size_t lod_draws, lod_triangles_saved; // draws at a coarser level, and what they didn't draw
+		size_t object_draws; uint64_t draw_ns; // calls to draw(), and the CPU time spent in them
+		size_t matrix_inversions, uniform_uploads; // normal matrices made, glUniform calls
+		size_t unshared_uniform_uploads; // what setting every uniform for every mesh would have made
+		size_t instanced_draws; // each drawing meshes of many instances
+	};
+	static const stats_t& stats();
+	static void reset_draw_stats();
 	void draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light_0,bool cycles,const glm::vec4& colour = glm::vec4(1,1,1,1));
-	void bounds(glm::vec3& min,glm::vec3& max);
+	struct instance_t {
+		instance_t(float t,const glm::mat4& mv,const glm::vec4& c): time(t), modelview(mv), colour(c) {}
+		float time; // as draw() takes it
+		glm::mat4 modelview;
+		glm::vec4 colour;
+	};
+	typedef std::vector<instance_t> instances_t;
+	// as draw() for each, but the instances in the same pose of a mesh are one instanced draw where possible
+	void draw(const instances_t& instances,const glm::mat4& projection,const glm::vec3& light_0,bool cycles);
+	void bounds(glm::vec3& min,glm::vec3& max); // over all frames, normals included
+	void bounds(float time,bool cycles,glm::vec3& min,glm::vec3& max); // of the pose draw() would draw, positions only
 	bool is_ready() const;
+	// for when something else, such as g3d_batch_t, has taken its own copy: free the arrays, as DISCARD_CPU_COPY would have
+	void discard_cpu_copy();
+	// and free the GL buffers, if nothing will draw() us again; the bounds remain
+	void release_gl();
 private:
 	struct mesh_t;
 	friend struct mesh_t;
-	enum { LOAD_G3D };
-	void on_io(const std::string& name,bool ok,const std::string& bytes,intptr_t data);
+	struct instance_data_t;
+	struct parse_job_t;
+	friend struct parse_job_t;
+	enum { LOAD_G3D, LOAD_G3DC };
+	parse_job_t* parsing; // until it fires
+	void on_io(const std::string& name,bool ok,const main_t::bytes_t& bytes,intptr_t data);
+	void on_parsed(parse_job_t& job);
 	void on_ready(mesh_t* mesh);
+	void bind_buffer(GLenum target,GLuint buffer); // through main_t's gl_state_t, counting what reaches GL
 	typedef std::vector<mesh_t*> meshes_t;
 	meshes_t meshes;
+	meshes_t draw_order; // the meshes, those sharing a program together
+	static bool by_program(const mesh_t* a,const mesh_t* b);
 	loaded_t* observer;
 	intptr_t observer_data;
 };
 
+// bounds are checked once per block, not per byte; the data is little endian, as is every platform we target
 class binary_reader_t {
 public:
-	binary_reader_t(const std::string& d): data(d), ofs(0) {}
+	binary_reader_t(const char* d,size_t len): data(d), data_len(len), ofs(0) {}
+	binary_reader_t(const std::string& d): data(d.data()), data_len(d.size()), ofs(0) {}
 	inline uint8_t byte() { return _r<uint8_t>(); }
 	inline uint16_t uint16() { return _r<uint16_t>(); };
 	inline uint32_t uint32() { return _r<uint32_t>(); };
 	inline float float32() { return _r<float>(); }
-	inline void skip(size_t bytes) { ofs += bytes; }
-	inline void read(void* dest,size_t bytes) { for(char* d = reinterpret_cast<char*>(dest); bytes--; d++) *d = data.at(ofs++); }
-	template<int N> std::string fixed_str() { ofs += N; return data.substr(ofs-N,N); }
+	inline void skip(size_t bytes) { block(bytes); }
+	inline void read(void* dest,size_t bytes) { memcpy(dest,block(bytes),bytes); }
+	template<typename T> void read_array(T* dest,size_t n) { read(dest,n*sizeof(T)); }
+	template<typename T> std::vector<T> read_array(size_t n) {
+		std::vector<T> v(n);
+		if(n) read_array(&v[0],n);
+		return v;
+	}
+	template<int N> std::string fixed_str() { return std::string(block(N),N); }
+	// returns a pointer to the next bytes, which need not be aligned, and moves past them
+	const char* block(size_t bytes) {
+		if(bytes > data_len-ofs)
+			data_error("read of " << bytes << " bytes at " << ofs << " overruns end (" << data_len << ')');
+		ofs += bytes;
+		return data+ofs-bytes;
+	}
+	size_t pos() const { return ofs; }
+	size_t remaining() const { return data_len-ofs; }
 private:
 	template<typename T> T _r() { T v; read(&v,sizeof(T)); return v; }
-	const std::string& data;
+	const char* const data;
+	const size_t data_len;
 	size_t ofs;
 };
 
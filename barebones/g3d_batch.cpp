@@ -0,0 +1,155 @@
+#include "g3d_batch.hpp"
+#include "gl_state.hpp"
+#include <algorithm>
+#include <cmath>
+
+g3d_batch_t::g3d_batch_t(main_t& m,float cs): main(m), chunk_size(cs), built(false) {
+	if(!(chunk_size > 0)) panic("chunk size " << chunk_size);
+	// the same program single-frame meshes draw with, so a batched model looks as it did
+	program = main.get_shared_program("g3d_single_frame");
+	graphics_assert(program && "g3d_single_frame"); // provided by game adaptation
+	uniform_mvp_matrix = main.get_uniform_loc(program,"MVP_MATRIX",GL_FLOAT_MAT4);
+	uniform_normal_matrix = main.get_uniform_loc(program,"NORMAL_MATRIX",GL_FLOAT_MAT3);
+	uniform_light_0 = main.get_uniform_loc(program,"LIGHT_0",GL_FLOAT_VEC3);
+	uniform_colour = main.get_uniform_loc(program,"COLOUR",GL_FLOAT_VEC4);
+	uniform_vertex_offset = main.get_uniform_loc(program,"VERTEX_OFFSET",GL_FLOAT_VEC3);
+	uniform_vertex_scale = main.get_uniform_loc(program,"VERTEX_SCALE",GL_FLOAT_VEC3);
+	uniform_tex_offset = main.get_uniform_loc(program,"TEX_OFFSET",GL_FLOAT_VEC2);
+	uniform_tex_scale = main.get_uniform_loc(program,"TEX_SCALE",GL_FLOAT_VEC2);
+	attrib_vertex_0 = main.get_attribute_loc(program,"VERTEX_0",GL_FLOAT_VEC3);
+	attrib_normal_0 = main.get_attribute_loc(program,"NORMAL_0",GL_FLOAT_VEC3);
+	attrib_tex = main.get_attribute_loc(program,"TEX_COORD_0",GL_FLOAT_VEC2);
+}
+
+g3d_batch_t::~g3d_batch_t() {
+	for(groups_t::iterator g=groups.begin(); g!=groups.end(); g++) {
+		if((*g)->vn_buf.buffer) {
+			main.get_buffer_arena(GL_ARRAY_BUFFER).free((*g)->vn_buf);
+			main.get_buffer_arena(GL_ELEMENT_ARRAY_BUFFER).free((*g)->i_buf);
+		}
+		if((*g)->t_buf.buffer)
+			main.get_buffer_arena(GL_ARRAY_BUFFER).free((*g)->t_buf);
+		delete *g;
+	}
+}
+
+bool g3d_batch_t::can_batch(const g3d_t& g3d) {
+	return g3d.residency == g3d_t::RETAIN_CPU_COPY && g3d.is_ready() && g3d.mesh_count() && g3d.is_static();
+}
+
+void g3d_batch_t::add(const g3d_t& g3d,const glm::mat4& modelview) {
+	if(built) panic("cannot add " << g3d.filename << " to a built batch");
+	if(!can_batch(g3d)) panic(g3d.filename << " cannot be batched");
+	// the chunk is where the model's origin lands
+	const glm::vec2 origin(modelview[3][0],modelview[3][1]);
+	const std::pair<int,int> chunk((int)floor(origin.x/chunk_size),(int)floor(origin.y/chunk_size));
+	// normals as the shader would transform them
+	const glm::mat3 normal_matrix(glm::inverse(glm::mat3(modelview)));
+	for(size_t m=0; m<g3d.mesh_count(); m++) {
+		const g3d_data_t::mesh_t& mesh = g3d.cpu_mesh(m);
+		const GLuint texture = g3d.mesh_texture(m);
+		const bool textured = texture && mesh.tex_frame_count;
+		group_t*& group = filling[group_key_t(chunk,textured? texture: 0)];
+		if(!group || group->vertex_count()+mesh.vertex_count > 0x10000) {
+			group = new group_t(textured? texture: 0,origin);
+			groups.push_back(group);
+		}
+		const GLushort base = group->vertex_count();
+		const GLfloat* vn = mesh.vn();
+		for(uint32_t v=0; v<mesh.vertex_count; v++, vn+=6) {
+			const glm::vec4 p(modelview*glm::vec4(vn[0],vn[1],vn[2],1));
+			const glm::vec3 n(normal_matrix*glm::vec3(vn[3],vn[4],vn[5]));
+			const GLfloat out[6] = {p.x,p.y,p.z,n.x,n.y,n.z};
+			group->vn.insert(group->vn.end(),out,out+6);
+			group->min = glm::min(group->min,glm::vec2(p.x,p.y));
+			group->max = glm::max(group->max,glm::vec2(p.x,p.y));
+		}
+		if(textured)
+			group->t.insert(group->t.end(),mesh.t(),mesh.t()+mesh.vertex_count*2);
+		const GLushort* i = mesh.i();
+		for(uint32_t j=0; j<mesh.index_count; j++)
+			group->i.push_back(base+i[j]);
+		_stats.meshes++;
+	}
+	_stats.models++;
+}
+
+void g3d_batch_t::build() {
+	if(built) return;
+	built = true;
+	filling.clear();
+	std::stable_sort(groups.begin(),groups.end(),group_t::by_texture); // fewer texture binds when drawing
+	buffer_arena_t& vertices = main.get_buffer_arena(GL_ARRAY_BUFFER), &indices = main.get_buffer_arena(GL_ELEMENT_ARRAY_BUFFER);
+	std::vector<std::pair<int,int> > chunks;
+	for(groups_t::iterator g=groups.begin(); g!=groups.end(); g++) {
+		group_t& group = **g;
+		if(group.i.empty()) continue;
+		group.vn_buf = vertices.alloc(group.vn.size()*sizeof(GLfloat));
+		vertices.upload(group.vn_buf,0,group.vn_buf.size,&group.vn[0]);
+		if(group.t.size()) {
+			group.t_buf = vertices.alloc(group.t.size()*sizeof(GLfloat));
+			vertices.upload(group.t_buf,0,group.t_buf.size,&group.t[0]);
+		}
+		group.i_buf = indices.alloc(group.i.size()*sizeof(GLushort));
+		indices.upload(group.i_buf,0,group.i_buf.size,&group.i[0]);
+		group.index_count = group.i.size();
+		_stats.bytes += group.vn_buf.size + group.t_buf.size + group.i_buf.size;
+		std::vector<GLfloat>().swap(group.vn);
+		std::vector<GLfloat>().swap(group.t);
+		std::vector<GLushort>().swap(group.i);
+		chunks.push_back(std::make_pair((int)floor(group.min.x/chunk_size),(int)floor(group.min.y/chunk_size)));
+	}
+	std::sort(chunks.begin(),chunks.end());
+	_stats.groups = groups.size();
+	_stats.chunks = std::unique(chunks.begin(),chunks.end())-chunks.begin();
+	main.get_gl_state().invalidate(); // the uploads bound behind its back
+}
+
+void g3d_batch_t::draw(const glm::mat4& projection,const glm::vec3& light_0,const glm::vec2& view_min,const glm::vec2& view_max) {
+	_stats.draws = 0;
+	if(!built) panic("batch drawn before it was built");
+	gl_state_t& gl = main.get_gl_state();
+	bool set_up = false;
+	for(groups_t::const_iterator g=groups.begin(); g!=groups.end(); g++) {
+		const group_t& group = **g;
+		if(!group.index_count ||
+			group.max.x < view_min.x || group.min.x > view_max.x ||
+			group.max.y < view_min.y || group.min.y > view_max.y)
+			continue;
+		if(!set_up) { // the vertices are already in place, so the model transform is the identity
+			glm::mat4 mvp(projection);
+			glm::mat3 identity(1);
+			glm::vec3 light(light_0), zero(0,0,0), one(1,1,1);
+			glm::vec4 colour(1,1,1,1);
+			glm::vec2 zero_2(0,0), one_2(1,1);
+			gl.use_program(program);
+			glUniformMatrix4fv(uniform_mvp_matrix,1,false,glm::value_ptr(mvp));
+			glUniformMatrix3fv(uniform_normal_matrix,1,false,glm::value_ptr(identity));
+			glUniform3fv(uniform_light_0,1,glm::value_ptr(light));
+			glUniform4fv(uniform_colour,1,glm::value_ptr(colour));
+			glUniform3fv(uniform_vertex_offset,1,glm::value_ptr(zero));
+			glUniform3fv(uniform_vertex_scale,1,glm::value_ptr(one));
+			glUniform2fv(uniform_tex_offset,1,glm::value_ptr(zero_2));
+			glUniform2fv(uniform_tex_scale,1,glm::value_ptr(one_2));
+			gl.bind_vertex_array(0); // pointers set are the bound vertex array's
+			glCheck();
+			set_up = true;
+		}
+		gl.bind_texture(0,group.texture);
+		gl.bind_buffer(GL_ARRAY_BUFFER,group.vn_buf.buffer);
+		glVertexAttribPointer(attrib_vertex_0,3,GL_FLOAT,GL_FALSE,6*sizeof(GLfloat),group.vn_buf.ptr());
+		glVertexAttribPointer(attrib_normal_0,3,GL_FLOAT,GL_FALSE,6*sizeof(GLfloat),group.vn_buf.ptr(3*sizeof(GLfloat)));
+		uint32_t attribs = gl_state_t::attrib_bit(attrib_vertex_0) | gl_state_t::attrib_bit(attrib_normal_0);
+		if(group.t_buf.buffer) {
+			gl.bind_buffer(GL_ARRAY_BUFFER,group.t_buf.buffer);
+			glVertexAttribPointer(attrib_tex,2,GL_FLOAT,GL_FALSE,0,group.t_buf.ptr());
+			attribs |= gl_state_t::attrib_bit(attrib_tex);
+		}
+		glCheck();
+		gl.use_attribs(attribs);
+		gl.bind_buffer(GL_ELEMENT_ARRAY_BUFFER,group.i_buf.buffer);
+		gl.draw_elements(GL_TRIANGLES,group.index_count,GL_UNSIGNED_SHORT,group.i_buf.ptr());
+		glCheck();
+		_stats.draws++;
+	}
+}
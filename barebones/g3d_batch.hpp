@@ -0,0 +1,53 @@
+#ifndef __G3D_BATCH_HPP__
+#define __G3D_BATCH_HPP__
+
+#include "g3d.hpp"
+#include "buffer_arena.hpp"
+#include <map>
+
+/* models that never move or animate, transformed into place once and merged into shared buffers
+   by texture and by square chunks of the xy plane, so a frame makes a draw per texture per visible
+   chunk rather than one per mesh per model.  Batched models are always drawn whole; levels of
+   detail are not used */
+class g3d_batch_t {
+public:
+	g3d_batch_t(main_t& main,float chunk_size);
+	~g3d_batch_t();
+	// loaded with RETAIN_CPU_COPY, and g3d_t::is_static()
+	static bool can_batch(const g3d_t& g3d);
+	void add(const g3d_t& g3d,const glm::mat4& modelview); // as g3d_t::draw() would take it; before build()
+	void build(); // uploads, freeing the merged arrays
+	// draw, with colour 1, the chunks overlapping the view's xy rectangle
+	void draw(const glm::mat4& projection,const glm::vec3& light_0,const glm::vec2& view_min,const glm::vec2& view_max);
+	main_t& main;
+	const float chunk_size;
+	struct stats_t {
+		stats_t(): models(0), meshes(0), groups(0), chunks(0), bytes(0), draws(0) {}
+		size_t models, meshes, groups, chunks, bytes;
+		size_t draws; // by the last draw()
+	};
+	const stats_t& stats() const { return _stats; }
+private:
+	struct group_t { // of one texture in one chunk; a chunk's texture may need more than one to stay in 16-bit indices
+		group_t(GLuint tex,const glm::vec2& origin): texture(tex), min(origin), max(origin), index_count(0) {}
+		GLuint texture;
+		glm::vec2 min, max; // of the vertices' xy
+		std::vector<GLfloat> vn, t; // laid out as g3d_data_t::mesh_t's
+		std::vector<GLushort> i;
+		buffer_arena_t::alloc_t vn_buf, t_buf, i_buf;
+		GLsizei index_count;
+		size_t vertex_count() const { return vn.size()/6; }
+		static bool by_texture(const group_t* a,const group_t* b) { return a->texture < b->texture; }
+	};
+	typedef std::vector<group_t*> groups_t;
+	groups_t groups;
+	typedef std::pair<std::pair<int,int>,GLuint> group_key_t; // chunk, texture
+	std::map<group_key_t,group_t*> filling; // until build()
+	bool built;
+	GLuint program, uniform_mvp_matrix, uniform_normal_matrix, uniform_light_0, uniform_colour,
+		uniform_vertex_offset, uniform_vertex_scale, uniform_tex_offset, uniform_tex_scale,
+		attrib_vertex_0, attrib_normal_0, attrib_tex;
+	stats_t _stats;
+};
+
+#endif//__G3D_BATCH_HPP__
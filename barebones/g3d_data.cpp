@@ -0,0 +1,413 @@
+#include "g3d.hpp"
+
+namespace {
+	// the cooked magic shares G3D's first three bytes; the fourth is 'C' where G3D has its version
+	const uint32_t COOKED_MAGIC = 'G' | ('3'<<8) | ('D'<<16) | ('C'<<24);
+	enum { COOKED_OPTIMISED = 1 }; // cooked flags
+
+	// appends little endian values to a string; the counterpart of binary_reader_t
+	class binary_writer_t {
+	public:
+		binary_writer_t(std::string& o): out(o) {}
+		void uint32(uint32_t v) { write(&v,sizeof(v)); }
+		void float32(float v) { write(&v,sizeof(v)); }
+		void write(const void* src,size_t bytes) { out.append(static_cast<const char*>(src),bytes); }
+		template<int N> void fixed_str(const std::string& s) {
+			if(s.size() >= N) data_error("cannot write " << s << " in " << N << " bytes");
+			out.append(s);
+			out.append(N-s.size(),'\0');
+		}
+		void align(size_t n) { out.append((n-out.size()%n)%n,'\0'); }
+	private:
+		std::string& out;
+	};
+
+	inline bool is_finite(float f) { return (f == f) && (f <= FLT_MAX) && (f >= -FLT_MAX); }
+
+	inline GLushort quantise_unorm16(float f,float offset,float scale) {
+		if(!is_finite(f)) return 0;
+		return (GLushort)std::min(std::max(floor((f-offset)/scale*65535.+.5),0.),65535.);
+	}
+
+	inline float dequantise_unorm16(GLushort q,float offset,float scale) {
+		return offset + scale*(q/65535.f);
+	}
+
+	// signed normalised with the given number of bits, as GL 4.2 decodes them: max(q/(2^(bits-1)-1),-1)
+	inline int quantise_snorm(float f,int bits) {
+		const int max = (1<<(bits-1))-1;
+		if(!is_finite(f)) return 0;
+		return (int)std::min(std::max(floor(f*max+.5),(double)-max),(double)max);
+	}
+
+	inline float dequantise_snorm(int q,int bits) {
+		return std::max((float)q/((1<<(bits-1))-1),-1.f);
+	}
+
+	// pick an offset and scale covering the finite values of every stride'th element from start
+	void quantise_range(const GLfloat* data,size_t count,size_t stride,float& offset,float& scale) {
+		float lo = FLT_MAX, hi = -FLT_MAX;
+		for(size_t i=0; i<count; i++, data+=stride)
+			if(is_finite(*data)) {
+				lo = std::min(lo,*data);
+				hi = std::max(hi,*data);
+			}
+		if(lo > hi) lo = hi = 0;
+		offset = lo;
+		scale = (hi > lo)? hi-lo: 1;
+	}
+
+	// cooked arrays are aligned in the file; if the buffer isn't, copy them out instead of pointing in
+	template<typename T> const T* cooked_array(binary_reader_t& in,size_t n,std::vector<T>& fallback) {
+		const char* p = in.block(n*sizeof(T));
+		if(!((uintptr_t)p % sizeof(T)))
+			return reinterpret_cast<const T*>(p);
+		fallback.resize(n);
+		if(n) memcpy(&fallback[0],p,n*sizeof(T));
+		return NULL;
+	}
+}
+
+g3d_data_t::mesh_t::mesh_t():
+	frame_count(0), vertex_count(0), index_count(0), textures(0), tex_frame_count(0),
+	min(FLT_MAX/2,FLT_MAX/2,FLT_MAX/2), max(-FLT_MAX/2,-FLT_MAX/2,-FLT_MAX/2),
+	vn_ext(NULL), t_ext(NULL), i_ext(NULL) {}
+
+void g3d_data_t::mesh_t::swap(mesh_t& other) {
+	name.swap(other.name);
+	diffuse.swap(other.diffuse);
+	std::swap(frame_count,other.frame_count);
+	std::swap(vertex_count,other.vertex_count);
+	std::swap(index_count,other.index_count);
+	std::swap(textures,other.textures);
+	std::swap(tex_frame_count,other.tex_frame_count);
+	vn_data.swap(other.vn_data);
+	t_data.swap(other.t_data);
+	i_data.swap(other.i_data);
+	std::swap(min,other.min);
+	std::swap(max,other.max);
+	frame_min.swap(other.frame_min);
+	frame_max.swap(other.frame_max);
+	key_frames.swap(other.key_frames);
+	lods.swap(other.lods);
+	std::swap(vn_ext,other.vn_ext);
+	std::swap(t_ext,other.t_ext);
+	std::swap(i_ext,other.i_ext);
+}
+
+void g3d_data_t::mesh_t::key_frames_at(float t,uint32_t& frame_0,uint32_t& frame_1,float& lerp) const {
+	if(key_frames.empty()) {
+		frame_0 = std::min((uint32_t)t,frame_count-1);
+		frame_1 = (frame_0+1) % frame_count;
+		lerp = t-frame_0;
+		return;
+	}
+	// the last key frame lerps towards the first, as the last source frame does when cycling
+	frame_0 = std::upper_bound(key_frames.begin(),key_frames.end(),(uint32_t)t)-key_frames.begin()-1;
+	frame_1 = (frame_0+1) % frame_count;
+	const uint32_t from = key_frames[frame_0], to = frame_1? key_frames[frame_1]: source_frame_count();
+	lerp = (t-from)/(to-from);
+}
+
+void g3d_data_t::mesh_t::frames_at(float time,bool cycles,uint32_t& frame_0,uint32_t& frame_1,float& lerp) const {
+	// time runs over the source frames, which decimation may have left only some of
+	const uint32_t source_frames = source_frame_count();
+	const uint32_t span = ((source_frames > 1) && !cycles)? source_frames-1: source_frames;
+	time = std::min(std::max(time,0.0f),1.0f) * (float)span;
+	if(time >= span) time = 0; // the end wraps to the start, as it always has
+	key_frames_at(time,frame_0,frame_1,lerp);
+}
+
+void g3d_data_t::mesh_t::own_arrays() {
+	if(vn_ext) vn_data.assign(vn_ext,vn_ext+frame_count*vertex_count*6);
+	if(t_ext) t_data.assign(t_ext,t_ext+tex_frame_count*vertex_count*2);
+	if(i_ext) i_data.assign(i_ext,i_ext+index_count);
+	vn_ext = t_ext = NULL;
+	i_ext = NULL;
+}
+
+void g3d_data_t::mesh_t::free_arrays() {
+	std::vector<GLfloat>().swap(vn_data);
+	std::vector<GLfloat>().swap(t_data);
+	std::vector<GLushort>().swap(i_data);
+	for(lods_t::iterator l=lods.begin(); l!=lods.end(); l++)
+		std::vector<GLushort>().swap(l->i_data);
+	vn_ext = t_ext = NULL;
+	i_ext = NULL;
+}
+
+size_t g3d_data_t::mesh_t::lods_size() const {
+	size_t bytes = 0;
+	for(lods_t::const_iterator l=lods.begin(); l!=lods.end(); l++)
+		bytes += l->i_size();
+	return bytes;
+}
+
+void g3d_data_t::load(binary_reader_t& in,bool optimise) {
+	const uint32_t ver = in.uint32();
+	// note the endian here is little endian
+	if(COOKED_MAGIC == ver) {
+		const uint32_t cooked_ver = in.uint32();
+		if(cooked_ver < 1 || cooked_ver > COOKED_VERSION) data_error("not a supported cooked G3D version");
+		// version 1 was unoptimised and version 2 optimised; since 3 it is a flag
+		const uint32_t flags = (cooked_ver >= 3)? in.uint32(): (cooked_ver == 2)? COOKED_OPTIMISED: 0;
+		const uint32_t mesh_count = in.uint32();
+		if(!mesh_count) data_error("has no meshes");
+		if(mesh_count > in.remaining()) data_error("bad mesh count: " << mesh_count);
+		cooked = true;
+		optimised = optimise || (flags & COOKED_OPTIMISED);
+		meshes.resize(mesh_count);
+		for(uint32_t i=0; i<mesh_count; i++) {
+			load_cooked_mesh(meshes[i],in,cooked_ver);
+			if(optimise && !(flags & COOKED_OPTIMISED))
+				meshes[i].optimise();
+		}
+		return;
+	}
+	if(((ver&0xff)!='G')||(((ver>>8)&0xff)!='3')||(((ver>>16)&0xff)!='D'))
+		data_error("(" << std::hex << ver << ") is not a G3D model");
+	switch(ver>>24) {
+	//case 3: {
+	//} break;
+	case 4: {
+		const uint16_t mesh_count = in.uint16();
+		if(!mesh_count) data_error("has no meshes");
+		if(in.byte()) data_error("not a G3D mtMorphMesh");
+		optimised = optimise;
+		meshes.resize(mesh_count);
+		for(int16_t i=0; i<mesh_count; i++) {
+			load_mesh(meshes[i],in,ver>>24);
+			if(optimise)
+				meshes[i].optimise();
+		}
+	} break;
+	default: data_error("not a supported G3D model version (" << (ver&0xff) << ")");
+	}
+}
+
+void g3d_data_t::load_mesh(mesh_t& mesh,binary_reader_t& in,char ver) {
+	if(ver != 4) data_error("not a supported G3D mesh version (" << (int)ver << ")");
+	mesh.name = std::string(in.fixed_str<64>().c_str());
+	const std::string& name = mesh.name;
+	const uint32_t frame_count = mesh.frame_count = in.uint32(); if(!frame_count) data_error(name << " has no frames");
+	const uint32_t vertex_count = mesh.vertex_count = in.uint32(); if(!vertex_count) data_error(name << " has no vertices");
+	const uint32_t index_count = mesh.index_count = in.uint32(); if(!index_count) data_error(name << " has no indices");
+	if(index_count%3) data_error(name << " bad number of indices: " << index_count);
+	if(vertex_count > 0x10000) data_error(name << " has too many vertices for 16-bit indices: " << vertex_count);
+	in.skip(9*4);
+	mesh.textures = in.uint32();
+	for(int t=0; t<5; t++)
+		if((1<<t)&mesh.textures) {
+			const std::string path = std::string(in.fixed_str<64>().c_str());
+			if(t==0) // diffuse?
+				mesh.diffuse = path;
+		}
+	const uint32_t tex_frame_count = mesh.tex_frame_count = mesh.textures?1:0;
+	// check the whole mesh fits before allocating anything sized by the header
+	const uint64_t mesh_bytes = (uint64_t)frame_count*vertex_count*6*sizeof(GLfloat) +
+		(uint64_t)tex_frame_count*vertex_count*2*sizeof(GLfloat) +
+		(uint64_t)index_count*sizeof(uint32_t);
+	if(mesh_bytes > in.remaining())
+		data_error(name << " needs " << mesh_bytes << " bytes but only " << in.remaining() << " remain");
+	// the file has all the frames' vertices then all the frames' normals; we interleave them per frame.
+	// the bounds include the normals as they always have; artwork rects are tuned to that
+	mesh.vn_data.resize(vertex_count*frame_count*6);
+	mesh.frame_min.assign(frame_count,glm::vec3(FLT_MAX/2,FLT_MAX/2,FLT_MAX/2));
+	mesh.frame_max.assign(frame_count,glm::vec3(-FLT_MAX/2,-FLT_MAX/2,-FLT_MAX/2));
+	std::vector<GLfloat> block(vertex_count*3);
+	for(int pass=0; pass<2; pass++) //0==vertices,1==normals
+		for(uint32_t f=0; f<frame_count; f++) {
+			in.read_array(&block[0],block.size());
+			const GLfloat* src = &block[0];
+			GLfloat* dest = &mesh.vn_data[f*vertex_count*6 + pass*3];
+			for(uint32_t v=0; v<vertex_count; v++, dest+=6)
+				for(int j=0; j<3; j++, src++) {
+					dest[j] = *src;
+					mesh.min[j] = std::min(*src,mesh.min[j]);
+					mesh.max[j] = std::max(*src,mesh.max[j]);
+					if(!pass) {
+						mesh.frame_min[f][j] = std::min(*src,mesh.frame_min[f][j]);
+						mesh.frame_max[f][j] = std::max(*src,mesh.frame_max[f][j]);
+					}
+				}
+		}
+	mesh.t_data.resize(tex_frame_count*vertex_count*2);
+	if(tex_frame_count) {
+		in.read_array(&mesh.t_data[0],mesh.t_data.size());
+		for(size_t slot=1; slot<mesh.t_data.size(); slot+=2)
+			mesh.t_data[slot] = 1.-mesh.t_data[slot]; // invert Y
+	}
+	std::vector<uint32_t> indices(in.read_array<uint32_t>(index_count));
+	mesh.i_data.resize(index_count);
+	for(uint32_t i=0; i<index_count; i++) {
+		if(indices[i] >= vertex_count)
+			data_error("index[" << i << "]=" << indices[i] << " out of bounds (" << vertex_count << ')');
+		mesh.i_data[i] = indices[i];
+	}
+}
+
+/* cooked layout, little endian, every block starting 4-byte aligned:
+	"G3DC", uint32 version, uint32 flags, uint32 mesh_count, then per mesh:
+		char name[64], char diffuse[64],
+		uint32 frame_count, vertex_count, index_count, textures, tex_frame_count,
+		float min[3], max[3],
+		float frame_min[3], frame_max[3] per frame,
+		uint32 source frame per frame,
+		float x,y,z,nx,ny,nz per vertex per frame,
+		float u,v per vertex per tex frame with v inverted,
+		uint16 indices padded to 4 bytes,
+		uint32 lod_count, then per level: float error, uint32 index_count, uint16 indices padded to 4 bytes
+	versions 1 and 2 have no flags or source frames; 2 is optimised. Before 4 there are no levels of detail */
+void g3d_data_t::load_cooked_mesh(mesh_t& mesh,binary_reader_t& in,uint32_t ver) {
+	mesh.name = std::string(in.fixed_str<64>().c_str());
+	mesh.diffuse = std::string(in.fixed_str<64>().c_str());
+	const std::string& name = mesh.name;
+	const uint32_t frame_count = mesh.frame_count = in.uint32(); if(!frame_count) data_error(name << " has no frames");
+	const uint32_t vertex_count = mesh.vertex_count = in.uint32(); if(!vertex_count) data_error(name << " has no vertices");
+	const uint32_t index_count = mesh.index_count = in.uint32(); if(!index_count || (index_count%3)) data_error(name << " bad number of indices: " << index_count);
+	if(vertex_count > 0x10000) data_error(name << " has too many vertices for 16-bit indices: " << vertex_count);
+	mesh.textures = in.uint32();
+	const uint32_t tex_frame_count = mesh.tex_frame_count = in.uint32();
+	const uint64_t mesh_bytes = (uint64_t)frame_count*(6*sizeof(GLfloat) + (ver >= 3? sizeof(uint32_t): 0) + mesh.vn_frame_size()) +
+		(uint64_t)tex_frame_count*mesh.t_frame_size() + mesh.i_size() + 6*sizeof(GLfloat);
+	if(mesh_bytes > in.remaining())
+		data_error(name << " needs " << mesh_bytes << " bytes but only " << in.remaining() << " remain");
+	in.read_array(&mesh.min[0],3);
+	in.read_array(&mesh.max[0],3);
+	mesh.frame_min.resize(frame_count);
+	mesh.frame_max.resize(frame_count);
+	for(uint32_t f=0; f<frame_count; f++) {
+		in.read_array(&mesh.frame_min[f][0],3);
+		in.read_array(&mesh.frame_max[f][0],3);
+	}
+	if(ver >= 3) {
+		mesh.key_frames = in.read_array<uint32_t>(frame_count);
+		bool decimated = false;
+		for(uint32_t f=0; f<frame_count; f++) {
+			if((f && mesh.key_frames[f] <= mesh.key_frames[f-1]) || (!f && mesh.key_frames[f]))
+				data_error(name << " bad source frame " << f << ": " << mesh.key_frames[f]);
+			decimated |= (mesh.key_frames[f] != f);
+		}
+		if(!decimated)
+			mesh.key_frames.clear();
+	}
+	mesh.vn_ext = cooked_array(in,frame_count*vertex_count*6,mesh.vn_data);
+	mesh.t_ext = cooked_array(in,tex_frame_count*vertex_count*2,mesh.t_data);
+	mesh.i_ext = cooked_array(in,index_count,mesh.i_data);
+	in.skip((index_count&1)*sizeof(GLushort));
+	const GLushort* indices = mesh.i();
+	for(uint32_t i=0; i<index_count; i++)
+		if(indices[i] >= vertex_count)
+			data_error("index[" << i << "]=" << indices[i] << " out of bounds (" << vertex_count << ')');
+	if(ver < 4) return;
+	const uint32_t lod_count = in.uint32();
+	if(lod_count > mesh_t::MAX_LODS) data_error(name << " bad number of levels of detail: " << lod_count);
+	mesh.lods.resize(lod_count);
+	for(mesh_t::lods_t::iterator l=mesh.lods.begin(); l!=mesh.lods.end(); l++) {
+		l->error = in.float32();
+		l->index_count = in.uint32();
+		if(!l->index_count || (l->index_count%3) || l->index_count >= index_count)
+			data_error(name << " bad number of level of detail indices: " << l->index_count);
+		l->i_data = in.read_array<GLushort>(l->index_count); // small, so always copied
+		in.skip((l->index_count&1)*sizeof(GLushort));
+		for(uint32_t i=0; i<l->index_count; i++)
+			if(l->i_data[i] >= vertex_count)
+				data_error("level of detail index[" << i << "]=" << l->i_data[i] << " out of bounds (" << vertex_count << ')');
+	}
+}
+
+std::string g3d_data_t::cook() const {
+	std::string bytes;
+	binary_writer_t out(bytes);
+	out.uint32(COOKED_MAGIC);
+	out.uint32(COOKED_VERSION);
+	out.uint32(optimised? COOKED_OPTIMISED: 0);
+	out.uint32(meshes.size());
+	for(meshes_t::const_iterator m=meshes.begin(); m!=meshes.end(); m++) {
+		out.fixed_str<64>(m->name);
+		out.fixed_str<64>(m->diffuse);
+		out.uint32(m->frame_count);
+		out.uint32(m->vertex_count);
+		out.uint32(m->index_count);
+		out.uint32(m->textures);
+		out.uint32(m->tex_frame_count);
+		out.write(&m->min[0],3*sizeof(GLfloat));
+		out.write(&m->max[0],3*sizeof(GLfloat));
+		for(uint32_t f=0; f<m->frame_count; f++) {
+			out.write(&m->frame_min[f][0],3*sizeof(GLfloat));
+			out.write(&m->frame_max[f][0],3*sizeof(GLfloat));
+		}
+		for(uint32_t f=0; f<m->frame_count; f++)
+			out.uint32(m->key_frames.size()? m->key_frames[f]: f);
+		out.write(m->vn(),m->frame_count*m->vn_frame_size());
+		out.write(m->t(),m->tex_frame_count*m->t_frame_size());
+		out.write(m->i(),m->i_size());
+		out.align(4);
+		out.uint32(m->lods.size());
+		for(mesh_t::lods_t::const_iterator l=m->lods.begin(); l!=m->lods.end(); l++) {
+			out.float32(l->error);
+			out.uint32(l->index_count);
+			out.write(&l->i_data[0],l->i_size());
+			out.align(4);
+		}
+	}
+	return bytes;
+}
+
+g3d_data_t::quantised_t::quantised_t(const mesh_t& mesh,normal_format_t nf): normal_format(nf),
+	max_vertex_error(0), rms_vertex_error(0), max_normal_error(0), max_tex_error(0) {
+	const size_t vertices = mesh.frame_count*mesh.vertex_count, tex_vertices = mesh.tex_frame_count*mesh.vertex_count;
+	const GLfloat* vn = mesh.vn();
+	for(int j=0; j<3; j++)
+		quantise_range(vn+j,vertices,6,vertex_offset[j],vertex_scale[j]);
+	double sum_sq = 0;
+	size_t finite = 0;
+	vn_data.resize(vertices);
+	for(size_t v=0; v<vertices; v++, vn+=6) {
+		vertex_t& q = vn_data[v];
+		GLushort* xyz[3] = {&q.x,&q.y,&q.z};
+		q.pad = 0;
+		float err_sq = 0;
+		bool ok = true;
+		for(int j=0; j<3; j++) {
+			*xyz[j] = quantise_unorm16(vn[j],vertex_offset[j],vertex_scale[j]);
+			const float err = vn[j]-dequantise_unorm16(*xyz[j],vertex_offset[j],vertex_scale[j]);
+			err_sq += err*err;
+			ok &= is_finite(vn[j]);
+		}
+		if(ok) {
+			max_vertex_error = std::max(max_vertex_error,sqrtf(err_sq));
+			sum_sq += err_sq;
+			finite++;
+		}
+		q.normal = 0;
+		for(int j=0; j<3; j++) {
+			const float n = std::min(std::max(vn[3+j],-1.f),1.f); // the file's normals are meant to be unit length
+			float decoded;
+			if(NORMAL_10_10_10_2 == normal_format) {
+				const int c = quantise_snorm(n,10);
+				q.normal |= (uint32_t)(c & 0x3ff) << (j*10);
+				decoded = dequantise_snorm(c,10);
+			} else {
+				const int c = quantise_snorm(n,8);
+				q.normal |= (uint32_t)(c & 0xff) << (j*8);
+				decoded = dequantise_snorm(c,8);
+			}
+			if(is_finite(vn[3+j]))
+				max_normal_error = std::max(max_normal_error,fabsf(vn[3+j]-decoded));
+		}
+	}
+	rms_vertex_error = finite? sqrt(sum_sq/finite): 0;
+	const GLfloat* t = mesh.t();
+	tex_offset = glm::vec2(0,0);
+	tex_scale = glm::vec2(1,1);
+	if(tex_vertices)
+		for(int j=0; j<2; j++)
+			quantise_range(t+j,tex_vertices,2,tex_offset[j],tex_scale[j]);
+	t_data.resize(tex_vertices*2);
+	for(size_t i=0; i<t_data.size(); i++) {
+		t_data[i] = quantise_unorm16(t[i],tex_offset[i%2],tex_scale[i%2]);
+		if(is_finite(t[i]))
+			max_tex_error = std::max(max_tex_error,fabsf(t[i]-dequantise_unorm16(t_data[i],tex_offset[i%2],tex_scale[i%2])));
+	}
+}
@@ -0,0 +1,259 @@
+#include "g3d.hpp"
+#include <queue>
+#include <algorithm>
+#include <iterator>
+#include <map>
+
+/* levels of detail by half-edge collapse, costed with Garland and Heckbert's quadric error metric:
+	a vertex is folded into a neighbour, so no vertices are made or moved and each level is just an
+	index array over the frames the mesh already has. Every vertex keeps a quadric per frame and a
+	collapse costs what it does in its worst frame, so a level holds up all through the animation.
+	Vertices on open or non-manifold edges, which is where exporters split UV seams, never move */
+
+namespace {
+	// the sum of squared distances to a set of planes
+	struct quadric_t {
+		quadric_t() { std::fill(q,q+10,0.); }
+		void add_plane(const glm::vec3& n,double d) {
+			q[0] += n.x*n.x; q[1] += n.x*n.y; q[2] += n.x*n.z; q[3] += n.x*d;
+			q[4] += n.y*n.y; q[5] += n.y*n.z; q[6] += n.y*d;
+			q[7] += n.z*n.z; q[8] += n.z*d;
+			q[9] += d*d;
+		}
+		quadric_t& operator+=(const quadric_t& other) {
+			for(int i=0; i<10; i++)
+				q[i] += other.q[i];
+			return *this;
+		}
+		double operator()(const glm::vec3& p) const {
+			const double x = p.x, y = p.y, z = p.z;
+			return q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x +
+				q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y +
+				q[7]*z*z + 2*q[8]*z + q[9];
+		}
+		double q[10];
+	};
+
+	struct collapse_t {
+		collapse_t(float c,GLushort f,GLushort t,uint32_t s): cost(c), from(f), to(t), stamp(s) {}
+		float cost; // in model units
+		GLushort from, to;
+		uint32_t stamp; // from's stamp when costed; stale if it has moved on
+		bool operator<(const collapse_t& other) const { return cost > other.cost; } // cheapest on top
+	};
+
+	class simplifier_t {
+	public:
+		simplifier_t(const g3d_data_t::mesh_t& mesh);
+		void run(float max_error,g3d_data_t::mesh_t::lods_t& lods);
+	private:
+		typedef std::vector<GLushort> vertices_t;
+		glm::vec3 pos(uint32_t frame,GLushort v) const {
+			const GLfloat* p = vn+((size_t)frame*vertex_count+v)*6;
+			return glm::vec3(p[0],p[1],p[2]);
+		}
+		const quadric_t& quadric(uint32_t frame,GLushort v) const { return quadrics[(size_t)frame*vertex_count+v]; }
+		bool has(size_t tri,GLushort v) const { return tris[tri*3] == v || tris[tri*3+1] == v || tris[tri*3+2] == v; }
+		void neighbours(GLushort v,vertices_t& out) const;
+		float cost(GLushort from,GLushort to) const;
+		bool is_valid(GLushort from,GLushort to) const;
+		void requeue(GLushort v);
+		void collapse(GLushort from,GLushort to);
+		void add_level(float error,g3d_data_t::mesh_t::lods_t& lods) const;
+		const GLfloat* const vn;
+		const uint32_t frame_count, vertex_count;
+		std::vector<GLushort> tris;
+		std::vector<bool> alive;
+		size_t live;
+		std::vector<std::vector<size_t> > tris_of; // may still list triangles that have died
+		std::vector<quadric_t> quadrics; // per frame, per vertex
+		std::vector<bool> locked, removed;
+		std::vector<uint32_t> stamps;
+		std::priority_queue<collapse_t> queue;
+	};
+
+	inline uint32_t edge_key(GLushort a,GLushort b) { return (a<b)? (uint32_t(a)<<16)|b: (uint32_t(b)<<16)|a; }
+}
+
+simplifier_t::simplifier_t(const g3d_data_t::mesh_t& mesh):
+	vn(mesh.vn()), frame_count(mesh.frame_count), vertex_count(mesh.vertex_count),
+	tris(mesh.i(),mesh.i()+mesh.index_count), alive(mesh.index_count/3,true), live(mesh.index_count/3),
+	tris_of(vertex_count), quadrics((size_t)frame_count*vertex_count),
+	locked(vertex_count,false), removed(vertex_count,false), stamps(vertex_count,0) {
+	std::map<uint32_t,uint32_t> edge_uses;
+	for(size_t t=0; t<alive.size(); t++) {
+		const GLushort* tri = &tris[t*3];
+		if(tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) { // draws nothing; drop it from the levels
+			alive[t] = false;
+			live--;
+			continue;
+		}
+		for(int j=0; j<3; j++) {
+			tris_of[tri[j]].push_back(t);
+			edge_uses[edge_key(tri[j],tri[(j+1)%3])]++;
+		}
+		for(uint32_t f=0; f<frame_count; f++) {
+			const glm::vec3 a(pos(f,tri[0])), b(pos(f,tri[1])), c(pos(f,tri[2]));
+			glm::vec3 n(glm::cross(b-a,c-a));
+			const float len = glm::length(n);
+			if(!(len > 0 && len <= FLT_MAX)) continue; // degenerate in this frame, or not finite
+			n = n/len;
+			const double d = -glm::dot(n,a);
+			for(int j=0; j<3; j++)
+				quadrics[(size_t)f*vertex_count+tri[j]].add_plane(n,d);
+		}
+	}
+	for(std::map<uint32_t,uint32_t>::const_iterator e=edge_uses.begin(); e!=edge_uses.end(); e++)
+		if(e->second != 2)
+			locked[e->first>>16] = locked[e->first&0xffff] = true;
+}
+
+void simplifier_t::neighbours(GLushort v,vertices_t& out) const {
+	out.clear();
+	for(std::vector<size_t>::const_iterator t=tris_of[v].begin(); t!=tris_of[v].end(); t++)
+		if(alive[*t])
+			for(int j=0; j<3; j++)
+				if(tris[*t*3+j] != v)
+					out.push_back(tris[*t*3+j]);
+	std::sort(out.begin(),out.end());
+	out.erase(std::unique(out.begin(),out.end()),out.end());
+}
+
+// how far, in the worst frame, from the planes both vertices have gathered does from end up
+float simplifier_t::cost(GLushort from,GLushort to) const {
+	double worst = 0;
+	for(uint32_t f=0; f<frame_count; f++) {
+		const glm::vec3 p(pos(f,to));
+		worst = std::max(worst,quadric(f,from)(p)+quadric(f,to)(p));
+	}
+	return sqrt(worst);
+}
+
+bool simplifier_t::is_valid(GLushort from,GLushort to) const {
+	// the link condition: they may share only the vertices across their shared edge, else the surface pinches
+	vertices_t a, b, shared;
+	neighbours(from,a);
+	neighbours(to,b);
+	std::set_intersection(a.begin(),a.end(),b.begin(),b.end(),std::back_inserter(shared));
+	size_t shared_tris = 0;
+	for(std::vector<size_t>::const_iterator t=tris_of[from].begin(); t!=tris_of[from].end(); t++)
+		if(alive[*t] && has(*t,to))
+			shared_tris++;
+	if(!shared_tris || shared.size() != shared_tris)
+		return false;
+	// no triangle that survives may flip or vanish in any frame
+	for(std::vector<size_t>::const_iterator t=tris_of[from].begin(); t!=tris_of[from].end(); t++) {
+		if(!alive[*t] || has(*t,to)) continue;
+		const GLushort* tri = &tris[*t*3];
+		for(uint32_t f=0; f<frame_count; f++) {
+			glm::vec3 p[3], q[3];
+			for(int j=0; j<3; j++) {
+				p[j] = pos(f,tri[j]);
+				q[j] = (tri[j] == from)? pos(f,to): p[j];
+			}
+			const glm::vec3 before(glm::cross(p[1]-p[0],p[2]-p[0])), after(glm::cross(q[1]-q[0],q[2]-q[0]));
+			if(glm::dot(before,before) > 0 && !(glm::dot(before,after) > 0))
+				return false;
+		}
+	}
+	return true;
+}
+
+// queue the cheapest collapse of v that is currently allowed
+void simplifier_t::requeue(GLushort v) {
+	if(locked[v] || removed[v]) return;
+	vertices_t candidates;
+	neighbours(v,candidates);
+	std::vector<std::pair<float,GLushort> > costs;
+	for(vertices_t::const_iterator n=candidates.begin(); n!=candidates.end(); n++)
+		costs.push_back(std::make_pair(cost(v,*n),*n));
+	std::sort(costs.begin(),costs.end());
+	for(size_t i=0; i<costs.size(); i++)
+		if(is_valid(v,costs[i].second)) {
+			queue.push(collapse_t(costs[i].first,v,costs[i].second,stamps[v]));
+			return;
+		}
+}
+
+void simplifier_t::collapse(GLushort from,GLushort to) {
+	for(std::vector<size_t>::const_iterator t=tris_of[from].begin(); t!=tris_of[from].end(); t++) {
+		if(!alive[*t]) continue;
+		if(has(*t,to)) {
+			alive[*t] = false;
+			live--;
+		} else {
+			for(int j=0; j<3; j++)
+				if(tris[*t*3+j] == from)
+					tris[*t*3+j] = to;
+			tris_of[to].push_back(*t);
+		}
+	}
+	for(uint32_t f=0; f<frame_count; f++)
+		quadrics[(size_t)f*vertex_count+to] += quadric(f,from);
+	removed[from] = true;
+	std::vector<size_t>().swap(tris_of[from]);
+	// everything around to has a new neighbourhood to cost
+	vertices_t around;
+	neighbours(to,around);
+	around.push_back(to);
+	for(vertices_t::const_iterator v=around.begin(); v!=around.end(); v++) {
+		stamps[*v]++;
+		requeue(*v);
+	}
+}
+
+void simplifier_t::add_level(float error,g3d_data_t::mesh_t::lods_t& lods) const {
+	lods.push_back(g3d_data_t::mesh_t::lod_t());
+	g3d_data_t::mesh_t::lod_t& lod = lods.back();
+	lod.error = error;
+	lod.i_data.reserve(live*3);
+	for(size_t t=0; t<alive.size(); t++) // in the full mesh's order, which is already cache friendly
+		if(alive[t])
+			lod.i_data.insert(lod.i_data.end(),&tris[t*3],&tris[t*3]+3);
+	lod.index_count = lod.i_data.size();
+}
+
+void simplifier_t::run(float max_error,g3d_data_t::mesh_t::lods_t& lods) {
+	for(uint32_t v=0; v<vertex_count; v++)
+		requeue(v);
+	const size_t min_tris = g3d_data_t::mesh_t::MIN_LOD_TRIANGLES;
+	size_t last = live, target = std::max(live/2,min_tris);
+	float error = 0;
+	while(!queue.empty() && lods.size() < g3d_data_t::mesh_t::MAX_LODS && live > min_tris) {
+		const collapse_t c = queue.top();
+		queue.pop();
+		if(removed[c.from] || c.stamp != stamps[c.from])
+			continue;
+		if(c.cost > max_error)
+			break; // and so would everything else be
+		if(removed[c.to] || !is_valid(c.from,c.to)) { // something near to has collapsed since
+			stamps[c.from]++;
+			requeue(c.from);
+			continue;
+		}
+		collapse(c.from,c.to);
+		error = std::max(error,c.cost);
+		if(live <= target) {
+			add_level(error,lods);
+			last = live;
+			target = std::max(live/2,min_tris);
+		}
+	}
+	// where we stopped is a level too, if it is a step worth taking
+	if(lods.size() < g3d_data_t::mesh_t::MAX_LODS && live <= last*3/4)
+		add_level(error,lods);
+}
+
+uint32_t g3d_data_t::mesh_t::build_lods(float max_error) {
+	lods.clear();
+	if(index_count < MIN_LOD_TRIANGLES*3*2 || frame_count < 1 || !(max_error > 0)) return 0;
+	glm::vec3 lo = frame_min[0], hi = frame_max[0];
+	for(uint32_t f=1; f<frame_count; f++) {
+		lo = glm::min(lo,frame_min[f]);
+		hi = glm::max(hi,frame_max[f]);
+	}
+	const float extent = std::max(hi.x-lo.x,std::max(hi.y-lo.y,hi.z-lo.z));
+	if(!(extent > 0) || extent > FLT_MAX) return 0;
+	simplifier_t(*this).run(max_error*extent,lods);
+	return lods.size();
+}
@@ -0,0 +1,255 @@
+#include "g3d.hpp"
+
+/* triangle order after Tom Forsyth's "Linear-Speed Vertex Cache Optimisation":
+	greedily emit the triangle whose vertices score highest, where a vertex scores
+	for being recently used and for having few triangles left to draw; then number
+	the vertices in the order the triangles first use them, so fetches walk forwards */
+
+namespace {
+	enum { SCORE_CACHE_SIZE = 32 };
+
+	class scorer_t {
+	public:
+		scorer_t() {
+			for(int i=0; i<SCORE_CACHE_SIZE; i++)
+				cache_score[i] = (i<3)? 0.75f: powf(1.f-(i-3)/(float)(SCORE_CACHE_SIZE-3),1.5f);
+			for(int i=0; i<VALENCE_SCORES; i++)
+				valence_score[i] = i? 2.f/sqrtf(i): 0;
+		}
+		float operator()(int cache_pos,size_t remaining) const {
+			if(!remaining) return -1; // nothing left to draw with it
+			return ((cache_pos < 0)? 0: cache_score[cache_pos]) +
+				((remaining < VALENCE_SCORES)? valence_score[remaining]: 2.f/sqrtf(remaining));
+		}
+	private:
+		enum { VALENCE_SCORES = 64 };
+		float cache_score[SCORE_CACHE_SIZE], valence_score[VALENCE_SCORES];
+	};
+
+	// vertex transforms for a FIFO post-transform cache of cache_size entries
+	size_t fifo_transforms(const GLushort* indices,size_t index_count,size_t vertex_count,size_t cache_size) {
+		std::vector<size_t> entered(vertex_count,0); // 1-based transform count when the vertex entered the FIFO; 0 is never
+		size_t transforms = 0;
+		for(size_t i=0; i<index_count; i++) {
+			const GLushort v = indices[i];
+			if(!entered[v] || transforms-entered[v] >= cache_size) {
+				transforms++;
+				entered[v] = transforms;
+			}
+		}
+		return transforms;
+	}
+
+	struct vertex_t {
+		vertex_t(): remaining(0), first_tri(0), cache_pos(-1), score(0) {}
+		size_t remaining, first_tri; // first_tri indexes the vertex's run in tris_of
+		int cache_pos;
+		float score;
+	};
+}
+
+void g3d_data_t::mesh_t::optimise() {
+	if(!index_count) return;
+	own_arrays();
+	static const scorer_t score;
+	const size_t tri_count = index_count/3;
+	std::vector<vertex_t> vertices(vertex_count);
+	for(uint32_t i=0; i<index_count; i++)
+		vertices[i_data[i]].remaining++;
+	std::vector<size_t> tris_of(index_count);
+	for(size_t v=0, ofs=0; v<vertex_count; v++) {
+		vertices[v].first_tri = ofs;
+		ofs += vertices[v].remaining;
+	}
+	{
+		std::vector<size_t> fill(vertex_count,0);
+		for(uint32_t i=0; i<index_count; i++) {
+			const GLushort v = i_data[i];
+			tris_of[vertices[v].first_tri + fill[v]++] = i/3;
+		}
+	}
+	for(size_t v=0; v<vertex_count; v++)
+		vertices[v].score = score(-1,vertices[v].remaining);
+	std::vector<float> tri_score(tri_count);
+	std::vector<bool> emitted(tri_count,false);
+	for(size_t t=0; t<tri_count; t++)
+		tri_score[t] = vertices[i_data[t*3]].score + vertices[i_data[t*3+1]].score + vertices[i_data[t*3+2]].score;
+	std::vector<GLushort> out;
+	out.reserve(index_count);
+	std::vector<GLushort> cache, next_cache;
+	cache.reserve(SCORE_CACHE_SIZE+3);
+	next_cache.reserve(SCORE_CACHE_SIZE+3);
+	size_t best = (size_t)-1, scan = 0;
+	for(size_t emitted_count=0; emitted_count<tri_count; emitted_count++) {
+		if(best == (size_t)-1) { // nothing in the cache scored; take the best of the rest
+			float best_score = -FLT_MAX;
+			for(; scan<tri_count && emitted[scan]; scan++); // everything before scan is emitted
+			for(size_t t=scan; t<tri_count; t++)
+				if(!emitted[t] && tri_score[t] > best_score) {
+					best_score = tri_score[t];
+					best = t;
+				}
+		}
+		emitted[best] = true;
+		const GLushort* tri = &i_data[best*3];
+		next_cache.assign(tri,tri+3);
+		for(int j=0; j<3; j++) {
+			vertex_t& vertex = vertices[tri[j]];
+			// move the emitted triangle to the end of the vertex's live run so the run stays compact
+			size_t* run = &tris_of[vertex.first_tri];
+			for(size_t k=0; k<vertex.remaining; k++)
+				if(run[k] == best) {
+					std::swap(run[k],run[vertex.remaining-1]);
+					break;
+				}
+			vertex.remaining--;
+			out.push_back(tri[j]);
+		}
+		for(std::vector<GLushort>::const_iterator c=cache.begin(); c!=cache.end(); c++)
+			if(*c != tri[0] && *c != tri[1] && *c != tri[2])
+				next_cache.push_back(*c);
+		cache.swap(next_cache);
+		// rescore whatever was in the cache, including any that just fell out, and their triangles
+		best = (size_t)-1;
+		float best_score = -FLT_MAX;
+		for(size_t c=0; c<cache.size(); c++) {
+			vertex_t& vertex = vertices[cache[c]];
+			vertex.cache_pos = (c < SCORE_CACHE_SIZE)? c: -1;
+			vertex.score = score(vertex.cache_pos,vertex.remaining);
+		}
+		for(size_t c=0; c<cache.size(); c++) {
+			const vertex_t& vertex = vertices[cache[c]];
+			for(size_t k=0; k<vertex.remaining; k++) {
+				const size_t t = tris_of[vertex.first_tri+k];
+				const float s = tri_score[t] = vertices[i_data[t*3]].score + vertices[i_data[t*3+1]].score + vertices[i_data[t*3+2]].score;
+				if(s > best_score) {
+					best_score = s;
+					best = t;
+				}
+			}
+		}
+		if(cache.size() > SCORE_CACHE_SIZE)
+			cache.resize(SCORE_CACHE_SIZE);
+	}
+	// the scoring models an LRU cache; exporters sometimes write near-perfect strips that it
+	// does worse on than the FIFO hardware would, so keep the original order for those
+	if(fifo_transforms(&out[0],index_count,vertex_count,g3d_data_t::VERTEX_CACHE_SIZE) >=
+		fifo_transforms(&i_data[0],index_count,vertex_count,g3d_data_t::VERTEX_CACHE_SIZE))
+		out = i_data;
+	// renumber the vertices by first use; any the indices never reach go last
+	std::vector<int> remap(vertex_count,-1);
+	std::vector<GLushort> order;
+	order.reserve(vertex_count);
+	for(std::vector<GLushort>::iterator i=out.begin(); i!=out.end(); i++) {
+		if(remap[*i] < 0) {
+			remap[*i] = order.size();
+			order.push_back(*i);
+		}
+		*i = remap[*i];
+	}
+	for(size_t v=0; v<vertex_count; v++)
+		if(remap[v] < 0)
+			order.push_back(v);
+	// the levels may only use vertices the full mesh does; checked before anything is changed
+	for(lods_t::const_iterator l=lods.begin(); l!=lods.end(); l++)
+		for(std::vector<GLushort>::const_iterator i=l->i_data.begin(); i!=l->i_data.end(); i++)
+			if(*i >= vertex_count || remap[*i] < 0)
+				data_error(name << " level of detail index " << *i << " is not a vertex of the full mesh");
+	i_data.swap(out);
+	for(lods_t::iterator l=lods.begin(); l!=lods.end(); l++)
+		for(std::vector<GLushort>::iterator i=l->i_data.begin(); i!=l->i_data.end(); i++)
+			*i = remap[*i];
+	// the same permutation for every morph frame and tex frame, so frames still line up
+	std::vector<GLfloat> permuted(vn_data.size());
+	for(uint32_t f=0; f<frame_count; f++)
+		for(size_t v=0; v<vertex_count; v++)
+			memcpy(&permuted[(f*vertex_count+v)*6],&vn_data[(f*vertex_count+order[v])*6],6*sizeof(GLfloat));
+	vn_data.swap(permuted);
+	permuted.resize(t_data.size());
+	for(uint32_t f=0; f<tex_frame_count; f++)
+		for(size_t v=0; v<vertex_count; v++)
+			memcpy(&permuted[(f*vertex_count+v)*2],&t_data[(f*vertex_count+order[v])*2],2*sizeof(GLfloat));
+	t_data.swap(permuted);
+}
+
+g3d_data_t::cache_stats_t g3d_data_t::mesh_t::cache_stats(size_t cache_size) const {
+	const GLushort* indices = i();
+	std::vector<bool> used(vertex_count,false);
+	size_t unique = 0;
+	for(uint32_t i=0; i<index_count; i++)
+		if(!used[indices[i]]) {
+			used[indices[i]] = true;
+			unique++;
+		}
+	const size_t transforms = fifo_transforms(indices,index_count,vertex_count,cache_size);
+	cache_stats_t stats;
+	stats.acmr = index_count? (float)transforms/(index_count/3): 0;
+	stats.atvr = unique? (float)transforms/unique: 0;
+	return stats;
+}
+
+namespace {
+	const float DECIMATE_NORMAL_ERROR = 0.05f; // per component; about 3 degrees, which the lighting doesn't show
+
+	// can frames a and c, lerped, stand in for every frame between them?
+	bool reproduces(const g3d_data_t::mesh_t& mesh,uint32_t a,uint32_t c,float max_error) {
+		const GLfloat* vn = mesh.vn();
+		const size_t frame_floats = mesh.vertex_count*6;
+		const float from = mesh.key_frames.size()? mesh.key_frames[a]: a,
+			to = mesh.key_frames.size()? mesh.key_frames[c]: c;
+		for(uint32_t b=a+1; b<c; b++) {
+			const float lerp = ((mesh.key_frames.size()? mesh.key_frames[b]: b)-from)/(to-from);
+			const GLfloat *va = vn+a*frame_floats, *vb = vn+b*frame_floats, *vc = vn+c*frame_floats;
+			for(uint32_t v=0; v<mesh.vertex_count; v++, va+=6, vb+=6, vc+=6) {
+				float err_sq = 0;
+				for(int j=0; j<6; j++) {
+					const float err = fabsf(va[j]+(vc[j]-va[j])*lerp-vb[j]);
+					if(!(err <= ((j<3)? max_error: DECIMATE_NORMAL_ERROR))) // catches non-finite too
+						return false;
+					if(j<3) err_sq += err*err;
+				}
+				if(err_sq > max_error*max_error)
+					return false;
+			}
+		}
+		return true;
+	}
+}
+
+uint32_t g3d_data_t::mesh_t::decimate(float max_error) {
+	if(frame_count < 3 || !(max_error > 0)) return 0;
+	glm::vec3 lo = frame_min[0], hi = frame_max[0];
+	for(uint32_t f=1; f<frame_count; f++) {
+		lo = glm::min(lo,frame_min[f]);
+		hi = glm::max(hi,frame_max[f]);
+	}
+	const float extent = std::max(hi.x-lo.x,std::max(hi.y-lo.y,hi.z-lo.z));
+	if(!(extent > 0) || extent > FLT_MAX) return 0;
+	max_error *= extent;
+	// greedily stretch each span as far as lerping its ends reproduces every frame within it
+	std::vector<uint32_t> keep(1,0);
+	for(uint32_t a=0, c; a<frame_count-1; a=c) {
+		for(c=a+1; c+1<frame_count && reproduces(*this,a,c+1,max_error); c++);
+		keep.push_back(c);
+	}
+	const uint32_t dropped = frame_count-keep.size();
+	if(!dropped) return 0;
+	own_arrays();
+	const size_t frame_floats = vertex_count*6;
+	std::vector<GLfloat> kept_vn(keep.size()*frame_floats);
+	std::vector<glm::vec3> kept_min(keep.size()), kept_max(keep.size());
+	std::vector<uint32_t> kept_keys(keep.size());
+	for(size_t k=0; k<keep.size(); k++) {
+		const uint32_t f = keep[k];
+		std::copy(vn_data.begin()+f*frame_floats,vn_data.begin()+(f+1)*frame_floats,kept_vn.begin()+k*frame_floats);
+		kept_min[k] = frame_min[f];
+		kept_max[k] = frame_max[f];
+		kept_keys[k] = key_frames.size()? key_frames[f]: f;
+	}
+	vn_data.swap(kept_vn);
+	frame_min.swap(kept_min);
+	frame_max.swap(kept_max);
+	key_frames.swap(kept_keys);
+	frame_count = keep.size();
+	return dropped;
+}
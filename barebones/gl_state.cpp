@@ -0,0 +1,176 @@
+#include "gl_state.hpp"
+
+gl_state_t::gl_state_t(): attribs(0), per_instance(0), stream_buffer(0) {
+	invalidate();
+}
+
+gl_state_t::~gl_state_t() {
+	if(stream_buffer)
+		glDeleteBuffers(1,&stream_buffer);
+}
+
+bool gl_state_t::use_program(GLuint p) {
+	if(program == p) {
+		frame.skipped++;
+		return false;
+	}
+	glUseProgram(p);
+	program = p;
+	frame.program_switches++;
+	return true;
+}
+
+bool gl_state_t::bind_buffer(GLenum target,GLuint buffer) {
+	GLuint& bound = (target == GL_ELEMENT_ARRAY_BUFFER)? element_buffer: array_buffer;
+	if(bound == buffer) {
+		frame.skipped++;
+		return false;
+	}
+	glBindBuffer(target,buffer);
+	bound = buffer;
+	frame.buffer_binds++;
+	return true;
+}
+
+bool gl_state_t::bind_texture(GLuint unit,GLuint texture) {
+	if(unit >= MAX_TEXTURE_UNITS)
+		panic("texture unit " << unit << " is not tracked");
+	if(textures[unit] == texture) {
+		frame.skipped++;
+		return false;
+	}
+	if(active_unit != unit) {
+		glActiveTexture(GL_TEXTURE0+unit);
+		active_unit = unit;
+	}
+	glBindTexture(GL_TEXTURE_2D,texture);
+	textures[unit] = texture;
+	frame.texture_binds++;
+	return true;
+}
+
+void gl_state_t::use_attribs(uint32_t mask,uint32_t instanced) {
+	bind_vertex_array(0);
+	mask |= instanced;
+	const uint32_t changed = attribs ^ mask, divisors = per_instance ^ instanced;
+	if(!changed && !divisors) {
+		frame.skipped++;
+		return;
+	}
+	for(GLuint location=0; location<32; location++) {
+		if(changed & (1U<<location)) {
+			if(mask & (1U<<location))
+				glEnableVertexAttribArray(location);
+			else
+				glDisableVertexAttribArray(location);
+			frame.attrib_toggles++;
+		}
+	#ifndef __native_client__
+		if(divisors & (1U<<location)) {
+			glVertexAttribDivisor(location,(instanced & (1U<<location))? 1: 0);
+			frame.attrib_toggles++;
+		}
+	#endif
+	}
+	attribs = mask;
+	per_instance = instanced;
+}
+
+void gl_state_t::draw_arrays(GLenum mode,GLint first,GLsizei count) {
+	glDrawArrays(mode,first,count);
+	frame.draw_calls++;
+}
+
+void gl_state_t::draw_elements(GLenum mode,GLsizei count,GLenum type,const GLvoid* indices) {
+	glDrawElements(mode,count,type,indices);
+	frame.draw_calls++;
+}
+
+void gl_state_t::draw_elements_instanced(GLenum mode,GLsizei count,GLenum type,const GLvoid* indices,GLsizei instances) {
+#ifdef __native_client__
+	panic("no instancing in GLES2");
+#else
+	glDrawElementsInstanced(mode,count,type,indices,instances);
+	frame.draw_calls++;
+	frame.instances += instances;
+#endif
+}
+
+void gl_state_t::delete_buffer(GLuint buffer) {
+	glDeleteBuffers(1,&buffer);
+	if(array_buffer == buffer) array_buffer = 0;
+	if(element_buffer == buffer) element_buffer = 0;
+	if(default_element_buffer == buffer) default_element_buffer = 0;
+}
+
+GLuint gl_state_t::instance_buffer() {
+	if(!stream_buffer)
+		glGenBuffers(1,&stream_buffer);
+	return stream_buffer;
+}
+
+void gl_state_t::delete_program(GLuint p) {
+	glDeleteProgram(p);
+	if(program == p) program = UNKNOWN; // its name may be reused
+}
+
+void gl_state_t::delete_texture(GLuint texture) {
+	glDeleteTextures(1,&texture);
+	for(GLuint unit=0; unit<MAX_TEXTURE_UNITS; unit++)
+		if(textures[unit] == texture) textures[unit] = 0;
+}
+
+bool gl_state_t::vertex_arrays_supported() {
+#ifdef __native_client__
+	return false; // GLES2 has only the OES extension, which pepper doesn't give us
+#else
+	return GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object;
+#endif
+}
+
+bool gl_state_t::bind_vertex_array(GLuint va,GLuint va_element_buffer) {
+	if(vertex_array == va) {
+		frame.skipped++;
+		return false;
+	}
+#ifdef __native_client__
+	if(va) panic("no vertex array objects in GLES2");
+#else
+	if(vertex_arrays_supported()) {
+		glBindVertexArray(va);
+		frame.vertex_array_binds++;
+	} else if(va)
+		panic("vertex array objects are not supported");
+#endif
+	if(!vertex_array)
+		default_element_buffer = element_buffer;
+	element_buffer = va? va_element_buffer: default_element_buffer;
+	vertex_array = va;
+	return true;
+}
+
+void gl_state_t::delete_vertex_array(GLuint va) {
+#ifndef __native_client__
+	if(vertex_array == va)
+		bind_vertex_array(0);
+	glDeleteVertexArrays(1,&va);
+#endif
+}
+
+void gl_state_t::invalidate() {
+	program = array_buffer = element_buffer = active_unit = vertex_array = default_element_buffer = UNKNOWN;
+	std::fill(textures,textures+MAX_TEXTURE_UNITS,(GLuint)UNKNOWN);
+}
+
+void gl_state_t::new_frame() {
+	if(DEBUG_CHECK_GL_ERROR == GL_CHECK_OFF) // nothing else asks, so count what the last frame left, with one glGetError() a frame rather than one a call
+		count_pending_gl_errors();
+	frame.gl_errors = take_gl_errors();
+	last_frame = frame;
+	frame = stats_t();
+	invalidate();
+}
+
+void gl_state_t::end_frame() {
+	bind_vertex_array(0);
+}
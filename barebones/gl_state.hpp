@@ -0,0 +1,58 @@
+#ifndef __GL_STATE_HPP__
+#define __GL_STATE_HPP__
+
+#include "main.hpp"
+
+/* the bindings our draws make, remembered so that setting what is already set never reaches GL,
+   and counted per frame.  Draws leave things bound rather than resetting them to 0.
+   Uploads outside a draw (buffer arenas, texture loading) may bind behind our back, so main_t
+   calls new_frame() before each tick(), which forgets everything bound; anything binding behind
+   our back in the middle of a frame must call invalidate().  Vertex attribute arrays are only
+   ever enabled and disabled through us, so they are never forgotten.
+   Vertex array objects (desktop GL 3 or ARB_vertex_array_object) hold their own attribute arrays
+   and element buffer; whoever builds one enables its arrays directly and tells us, when binding
+   it, what element buffer it holds.  use_attribs() is for the default vertex array, and binds it */
+class gl_state_t {
+public:
+	gl_state_t();
+	~gl_state_t(); // deletes the GL objects we made
+	// each returns whether the call reached GL
+	bool use_program(GLuint program);
+	bool bind_buffer(GLenum target,GLuint buffer); // GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER
+	bool bind_texture(GLuint unit,GLuint texture); // GL_TEXTURE_2D on GL_TEXTURE0+unit
+	// enable the attribute arrays whose locations are set in mask or per_instance, and disable all others;
+	// those in per_instance advance once per instance rather than once per vertex
+	void use_attribs(uint32_t mask,uint32_t per_instance=0);
+	static uint32_t attrib_bit(GLint location) { return (location >= 0 && location < 32)? 1U<<location: 0; }
+	void draw_arrays(GLenum mode,GLint first,GLsizei count);
+	void draw_elements(GLenum mode,GLsizei count,GLenum type,const GLvoid* indices);
+	void draw_elements_instanced(GLenum mode,GLsizei count,GLenum type,const GLvoid* indices,GLsizei instances);
+	void delete_buffer(GLuint buffer); // GL unbinds a deleted buffer, so we must too
+	void delete_texture(GLuint texture); // likewise, from every unit
+	void delete_program(GLuint program); // GL only deletes it once it isn't in use, so we forget which is
+	GLuint instance_buffer(); // a GL_ARRAY_BUFFER for streaming per-instance attributes into, made the first time
+	static bool vertex_arrays_supported();
+	bool bind_vertex_array(GLuint vertex_array,GLuint element_buffer=0);
+	void delete_vertex_array(GLuint vertex_array);
+	void invalidate();
+	void new_frame(); // invalidates
+	void end_frame(); // rebinds the default vertex array, so uploads between frames can't change one of ours
+	struct stats_t {
+		stats_t(): program_switches(0), buffer_binds(0), texture_binds(0), attrib_toggles(0), vertex_array_binds(0), draw_calls(0), instances(0), skipped(0), gl_errors(0) {}
+		size_t program_switches, buffer_binds, texture_binds, attrib_toggles, vertex_array_binds, draw_calls;
+		size_t instances; // drawn by instanced draw calls
+		size_t skipped; // calls that would have set what was already set
+		size_t gl_errors; // as counted by glCheck(), the debug output, or new_frame() when unchecked; see set_gl_check()
+	};
+	const stats_t& frame_stats() const { return last_frame; } // of the last whole frame
+private:
+	enum { UNKNOWN = ~0U, MAX_TEXTURE_UNITS = 8 };
+	GLuint program, array_buffer, element_buffer, active_unit, vertex_array;
+	GLuint textures[MAX_TEXTURE_UNITS];
+	uint32_t attribs, per_instance; // of the default vertex array
+	GLuint default_element_buffer; // while another vertex array is bound
+	GLuint stream_buffer; // instance_buffer(), or 0
+	stats_t frame, last_frame;
+};
+
+#endif//__GL_STATE_HPP__
@@ -0,0 +1,165 @@
+#include "jobs.hpp"
+#include <deque>
+#include <algorithm>
+#include <iostream>
+
+#ifndef __native_client__
+	#include <SDL.h>
+	#ifndef __WIN32
+		#include <unistd.h>
+	#endif
+	#define HAS_THREADS
+#endif
+
+int jobs_t::requested_workers = -1;
+
+struct jobs_t::_pimpl_t {
+	_pimpl_t(main_t& m): main(m), stopping(false) {}
+	main_t& main;
+	typedef std::deque<job_t*> queue_t;
+	queue_t pending, running, done;
+	bool stopping;
+	static bool take(queue_t& queue,job_t* job);
+	static void run(job_t* job) {
+		try {
+			job->run();
+		} catch(std::exception& e) { // run() should have caught it, so there is no one to tell
+			std::cerr << "ERROR in job: " << e.what() << std::endl;
+		}
+	}
+#ifdef HAS_THREADS
+	SDL_mutex* lock; // guards pending, running, done and stopping
+	SDL_cond* wake, *finished;
+	std::vector<SDL_Thread*> workers;
+	static int worker(void* ptr);
+#endif
+};
+
+#ifdef HAS_THREADS
+int jobs_t::_pimpl_t::worker(void* ptr) {
+	_pimpl_t* self = static_cast<_pimpl_t*>(ptr);
+	SDL_mutexP(self->lock);
+	for(;;) {
+		while(!self->stopping && self->pending.empty())
+			SDL_CondWait(self->wake,self->lock);
+		if(self->stopping)
+			break;
+		job_t* job = self->pending.front();
+		self->pending.pop_front();
+		self->running.push_back(job);
+		SDL_mutexV(self->lock);
+		run(job);
+		SDL_mutexP(self->lock);
+		take(self->running,job);
+		self->done.push_back(job);
+		SDL_CondBroadcast(self->finished);
+	}
+	SDL_mutexV(self->lock);
+	return 0;
+}
+#endif
+
+jobs_t::jobs_t(main_t& main,int workers): _pimpl(new _pimpl_t(main)) {
+#ifdef HAS_THREADS
+	_pimpl->lock = SDL_CreateMutex();
+	_pimpl->wake = SDL_CreateCond();
+	_pimpl->finished = SDL_CreateCond();
+	if(!_pimpl->lock || !_pimpl->wake || !_pimpl->finished)
+		panic("cannot create job queue: " << SDL_GetError());
+	for(int i=0; i<workers; i++)
+		if(SDL_Thread* thread = SDL_CreateThread(_pimpl_t::worker,_pimpl))
+			_pimpl->workers.push_back(thread);
+		else
+			std::cerr << "cannot start worker " << i << ": " << SDL_GetError() << std::endl;
+#endif
+}
+
+jobs_t::~jobs_t() {
+#ifdef HAS_THREADS
+	SDL_mutexP(_pimpl->lock);
+	_pimpl->stopping = true;
+	SDL_CondBroadcast(_pimpl->wake);
+	SDL_mutexV(_pimpl->lock);
+	for(std::vector<SDL_Thread*>::iterator w=_pimpl->workers.begin(); w!=_pimpl->workers.end(); w++)
+		SDL_WaitThread(*w,NULL);
+	SDL_DestroyCond(_pimpl->finished);
+	SDL_DestroyCond(_pimpl->wake);
+	SDL_DestroyMutex(_pimpl->lock);
+#endif
+	delete _pimpl;
+}
+
+void jobs_t::submit(job_t* job) {
+#ifdef HAS_THREADS
+	if(_pimpl->workers.size()) {
+		SDL_mutexP(_pimpl->lock);
+		_pimpl->pending.push_back(job);
+		SDL_CondSignal(_pimpl->wake);
+		SDL_mutexV(_pimpl->lock);
+		return;
+	}
+#endif
+	_pimpl->pending.push_back(job);
+}
+
+bool jobs_t::_pimpl_t::take(queue_t& queue,job_t* job) {
+	queue_t::iterator j = std::find(queue.begin(),queue.end(),job);
+	if(j == queue.end())
+		return false;
+	queue.erase(j);
+	return true;
+}
+
+void jobs_t::cancel(job_t* job) {
+#ifdef HAS_THREADS
+	if(_pimpl->workers.size()) {
+		SDL_mutexP(_pimpl->lock);
+		if(!_pimpl_t::take(_pimpl->pending,job)) {
+			while(std::find(_pimpl->running.begin(),_pimpl->running.end(),job) != _pimpl->running.end())
+				SDL_CondWait(_pimpl->finished,_pimpl->lock);
+			_pimpl_t::take(_pimpl->done,job);
+		}
+		SDL_mutexV(_pimpl->lock);
+	} else
+#endif
+		_pimpl_t::take(_pimpl->pending,job);
+	_pimpl->main.remove_callback(job); // if tick() has handed it on already
+	delete job;
+}
+
+void jobs_t::tick() {
+	_pimpl_t::queue_t finished;
+#ifdef HAS_THREADS
+	if(_pimpl->workers.size()) {
+		SDL_mutexP(_pimpl->lock);
+		finished.swap(_pimpl->done);
+		SDL_mutexV(_pimpl->lock);
+	} else
+#endif
+	{
+		finished.swap(_pimpl->pending);
+		for(_pimpl_t::queue_t::iterator j=finished.begin(); j!=finished.end(); j++)
+			_pimpl_t::run(*j);
+	}
+	for(_pimpl_t::queue_t::iterator j=finished.begin(); j!=finished.end(); j++)
+		_pimpl->main.add_callback(*j);
+}
+
+int jobs_t::worker_count() const {
+#ifdef HAS_THREADS
+	return _pimpl->workers.size();
+#else
+	return 0;
+#endif
+}
+
+int jobs_t::cpu_count() {
+#if defined(HAS_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cpus > 0)? cpus: 1;
+#elif defined(HAS_THREADS)
+	return 2; // a guess; SDL 1.2 can't tell us
+#else
+	return 0;
+#endif
+}
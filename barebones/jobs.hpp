@@ -0,0 +1,32 @@
+#ifndef __JOBS_HPP__
+#define __JOBS_HPP__
+
+#include "main.hpp"
+
+/* a pool of worker threads for the CPU side of loading: reading files, parsing models, decoding images.
+   A job's run() is called on a worker and must touch neither GL nor main_t; once it returns, the job is
+   passed to main_t::add_callback, so its on_fire() runs on the GL thread to upload and notify.
+   With no workers (NaCl, or asked for) run() is called on the GL thread at the next tick instead.
+   Jobs hold references to what they work for, so whatever submits one must cancel() it if it goes first */
+class jobs_t {
+public:
+	struct job_t: public main_t::callback_t {
+		virtual ~job_t() {}
+		virtual void run() = 0; // catch your own errors and report them from on_fire()
+	};
+	jobs_t(main_t& main,int workers);
+	~jobs_t(); // waits for running jobs; those not yet started are dropped, not fired
+	void submit(job_t* job); // the job must outlive its on_fire()
+	// on the GL thread, by an owner going before a job it submitted has fired: waits if the job is running,
+	// then deletes it without firing it
+	void cancel(job_t* job);
+	void tick(); // on the GL thread: hands finished jobs to main_t::add_callback
+	int worker_count() const;
+	static int cpu_count();
+	static int requested_workers; // for main_t::get_jobs(); negative, the default, is one per CPU
+	struct _pimpl_t;
+private:
+	_pimpl_t* _pimpl;
+};
+
+#endif//__JOBS_HPP__
@@ -1,19 +1,19 @@
 
-#if (defined(__native_client__) || defined(NDEBUG)) && !defined(GL_CHECK_ERROR)
-	// calling glGetError() is MASSIVE NaCl performance hit because it flushes the GL command buffer
-	bool DEBUG_CHECK_GL_ERROR = false;
-#else 
-	bool DEBUG_CHECK_GL_ERROR = true;
-#endif
-
 #include "main.hpp"
 #include "rand.hpp"
 #include "build_info.hpp"
+#include "asset_registry.hpp"
+#include "jobs.hpp"
+#include "gl_state.hpp"
+#include "batch_2d.hpp"
 #include <memory>
 #include <map>
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
 
 #include "../external/SOIL/SOIL.h"
+#include "../external/SOIL/image_helper.h"
 
 #ifdef __native_client__
 	#include "ppapi/cpp/instance.h"
@@ -30,7 +30,79 @@
 	#include "ppapi/cpp/graphics_3d.h"
 #else
 	#include <SDL.h>
+	#ifndef __WIN32
+		#include <sys/mman.h>
+		#include <sys/stat.h>
+		#include <fcntl.h>
+		#include <unistd.h>
+		#define HAS_MMAP
+	#endif
+#endif
+
+#if (defined(__native_client__) || defined(NDEBUG)) && !defined(GL_CHECK_ERROR)
+	// calling glGetError() is MASSIVE NaCl performance hit because it flushes the GL command buffer
+	gl_check_t DEBUG_CHECK_GL_ERROR = GL_CHECK_OFF;
+#else 
+	gl_check_t DEBUG_CHECK_GL_ERROR = GL_CHECK_SYNC;
 #endif
+const gl_check_site_t* volatile gl_check_site = NULL;
+static volatile int gl_errors = 0;
+
+void count_gl_error() {
+	__sync_add_and_fetch(&gl_errors,1);
+}
+
+void count_pending_gl_errors() {
+	for(int i=0; i<8 && glGetError() != GL_NO_ERROR; i++) // bounded in case the context is lost
+		count_gl_error();
+}
+
+size_t take_gl_errors() {
+	return __sync_fetch_and_and(&gl_errors,0);
+}
+
+#ifndef __native_client__
+#ifndef GL_DEBUG_OUTPUT
+	#define GL_DEBUG_OUTPUT 0x92E0 // KHR_debug, newer than our glew.h
+#endif
+#ifdef _WIN32
+	#define GL_CALLBACK __stdcall // as GLDEBUGPROCARB; glew.h takes back its APIENTRY
+#else
+	#define GL_CALLBACK
+#endif
+static void GL_CALLBACK gl_debug_output(GLenum source,GLenum type,GLuint id,GLenum severity,GLsizei length,const GLchar* message,GLvoid* data) {
+	// perhaps on a driver thread, and some way behind the calls made
+	count_gl_error();
+	const gl_check_site_t* const site = gl_check_site;
+	fprintf(stderr,"GL error %u, last checked at %s:%d: %s\n",(unsigned)id,site? site->file: "?",site? site->line: 0,message);
+}
+#endif
+
+void set_gl_check(gl_check_t mode) {
+#ifdef __native_client__
+	if(mode == GL_CHECK_ASYNC)
+		mode = GL_CHECK_SYNC; // no debug output in GLES2
+#else
+	if(GLEW_ARB_debug_output) {
+		if(mode == GL_CHECK_ASYNC) {
+			glEnable(GL_DEBUG_OUTPUT); // with KHR_debug, it is only on by default in debug contexts
+			glDebugMessageControlARB(GL_DONT_CARE,GL_DONT_CARE,GL_DONT_CARE,0,NULL,GL_FALSE);
+			glDebugMessageControlARB(GL_DONT_CARE,GL_DEBUG_TYPE_ERROR_ARB,GL_DONT_CARE,0,NULL,GL_TRUE);
+			glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS_ARB);
+			glDebugMessageCallbackARB(gl_debug_output,NULL);
+		} else {
+			glDebugMessageCallbackARB(NULL,NULL);
+			glDisable(GL_DEBUG_OUTPUT);
+		}
+	} else if(mode == GL_CHECK_ASYNC) {
+		fprintf(stderr,"no ARB_debug_output, so checking GL errors synchronously\n");
+		mode = GL_CHECK_SYNC;
+	}
+#endif
+	// forget errors from before, including GL_DEBUG_OUTPUT being unknown, with a bound in case the context is lost
+	for(int i=0; i<8 && glGetError() != GL_NO_ERROR; i++);
+	DEBUG_CHECK_GL_ERROR = mode;
+}
 
 namespace {
 	struct _file_io_impl_t;
@@ -39,6 +111,7 @@ namespace {
 
 struct main_t::_pimpl_t {
 	_pimpl_t(main_t& main,void* instance);
+	~_pimpl_t(); // releases the textures and shared programs while the registry and GL state are still here
 	main_t& main;
 	typedef std::vector<callback_t*> callbacks_t;
 	callbacks_t callbacks;
@@ -49,17 +122,163 @@ struct main_t::_pimpl_t {
 	textures_t textures;
 	typedef std::map<std::string,GLuint> shared_programs_t;
 	shared_programs_t shared_programs;
+	struct program_var_t {
+		GLint loc;
+		GLenum type;
+		GLint size;
+	};
+	typedef std::map<std::string,program_var_t> program_vars_t;
+	struct reflection_t {
+		program_vars_t uniforms, attributes;
+	};
+	typedef std::map<GLuint,reflection_t> reflections_t;
+	reflections_t reflections; // each program's active uniforms and attributes, asked of GL once when it's linked
+	reflection_t& reflect(GLuint program);
+	static GLint find(const program_vars_t& vars,const char* kind,const std::string& name,GLenum type,int size);
+	struct linking_t { // a program create_program() hasn't waited for
+		GLuint program, vs, fs; // the shaders are 0 if it was loaded from a binary
+		std::string vsrc, fsrc;
+		uint64_t key; // of its binary
+	};
+	typedef std::vector<linking_t> linkings_t;
+	linkings_t linking;
+	struct program_binary_t {
+		GLenum format;
+		std::string bytes;
+		bool used; // by this run; the unused aren't kept when the cache is written
+	};
+	typedef std::map<uint64_t,program_binary_t> program_binaries_t; // by hash of driver and source
+	program_binaries_t program_binaries;
+	bool program_binaries_read, program_binaries_dirty;
+	std::string driver;
+	bool use_program_binaries(); // reads the cache the first time
+	void write_program_binaries();
+	typedef std::map<GLenum,buffer_arena_t*> buffer_arenas_t;
+	buffer_arenas_t buffer_arenas;
+	std::auto_ptr<asset_registry_t> asset_registry;
+	std::auto_ptr<gl_state_t> gl_state;
+	std::auto_ptr<batch_2d_t> batch_2d; // after gl_state, so it goes first
 	input_key_map_t key_map;
 	input_mouse_map_t mouse_map;
 #ifdef __native_client__
 	pp::Instance* instance;
 #endif
+	std::auto_ptr<jobs_t> jobs; // last, so the workers stop before anything they work for goes
+};
+
+struct main_t::bytes_t::_buf_t {
+	_buf_t(): refs(1), data(NULL), size(0), mapped(false) {}
+	~_buf_t() {
+	#ifdef HAS_MMAP
+		if(mapped)
+			munmap(const_cast<char*>(data),size);
+	#endif
+	}
+	void set(std::string& b) { // takes the contents of b
+		bytes.swap(b);
+		data = bytes.data();
+		size = bytes.size();
+	}
+	volatile int refs;
+	const char* data;
+	size_t size;
+	bool mapped;
+	std::string bytes; // the data itself if not mapped; never changed once set, as copies may be on other threads
 };
 
+main_t::bytes_t::bytes_t(_buf_t* b): buf(b) {}
+
+main_t::bytes_t::bytes_t(const bytes_t& copy): buf(copy.buf) {
+	if(buf)
+		__sync_add_and_fetch(&buf->refs,1);
+}
+
+main_t::bytes_t& main_t::bytes_t::operator=(const bytes_t& copy) {
+	if(copy.buf != buf) {
+		if(copy.buf)
+			__sync_add_and_fetch(&copy.buf->refs,1);
+		release();
+		buf = copy.buf;
+	}
+	return *this;
+}
+
+const char* main_t::bytes_t::data() const { return buf? buf->data: NULL; }
+
+size_t main_t::bytes_t::size() const { return buf? buf->size: 0; }
+
+std::string main_t::bytes_t::str() const {
+	return buf? std::string(buf->data,buf->size): std::string();
+}
+
+void main_t::bytes_t::release() {
+	if(buf && !__sync_sub_and_fetch(&buf->refs,1))
+		delete buf;
+	buf = NULL;
+}
+
+void main_t::file_io_t::on_io(const std::string& name,bool ok,const bytes_t& bytes,intptr_t data) {
+	if(bytes.buf && !bytes.buf->mapped)
+		on_io(name,ok,bytes.buf->bytes,data); // read into a string already, so no copy
+	else
+		on_io(name,ok,bytes.str(),data);
+}
+
+void main_t::file_io_t::on_io(const std::string& name,bool ok,const std::string& bytes,intptr_t data) {
+	panic("on_io(" << name << ',' << data << ") not handled");
+}
+
 namespace {
-	struct _file_io_impl_t: public main_t::callback_t {
-		_file_io_impl_t(main_t::_pimpl_t& p,const std::string& n,main_t::file_io_t* cb,intptr_t d): 
-			pimpl(p), name(n), callback(cb), data(d), ok(false), cancelled(false)
+#ifndef __native_client__
+	bool read_bytes(const std::string& name,main_t::bytes_t& bytes) {
+		bool ok = false;
+		if(FILE* file = fopen(name.c_str(),"rb")) {
+			std::string buffer;
+			fseek(file,0,SEEK_END);
+			buffer.resize(ftell(file));
+			fseek(file,0,SEEK_SET);
+			size_t ofs = 0;
+			while(ofs < buffer.size()) {
+				const size_t read = fread(&buffer.at(ofs),1,buffer.size()-ofs,file);
+				if(read <= 0) break;
+				ofs += read;
+			}
+			ok = (ofs == buffer.size());
+			fclose(file);
+			main_t::bytes_t::_buf_t* buf = new main_t::bytes_t::_buf_t();
+			buf->set(buffer);
+			bytes = main_t::bytes_t(buf);
+		}
+		return ok;
+	}
+
+	bool map_bytes(const std::string& name,main_t::bytes_t& bytes) {
+	#ifdef HAS_MMAP
+		const int fd = open(name.c_str(),O_RDONLY);
+		if(fd == -1)
+			return false;
+		struct stat st;
+		void* addr = MAP_FAILED;
+		if(!fstat(fd,&st) && S_ISREG(st.st_mode) && st.st_size > 0)
+			addr = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+		close(fd); // the mapping keeps its own reference to the file
+		if(addr == MAP_FAILED)
+			return false;
+		main_t::bytes_t::_buf_t* buf = new main_t::bytes_t::_buf_t();
+		buf->data = static_cast<const char*>(addr);
+		buf->size = st.st_size;
+		buf->mapped = true;
+		bytes = main_t::bytes_t(buf);
+		return true;
+	#else
+		return false;
+	#endif
+	}
+#endif
+
+	struct _file_io_impl_t: public jobs_t::job_t {
+		_file_io_impl_t(main_t::_pimpl_t& p,const std::string& n,main_t::file_io_t* cb,intptr_t d,main_t::read_mode_t m): 
+			pimpl(p), name(n), callback(cb), data(d), mode(m), ok(false), cancelled(false)
 	#ifdef __native_client__
 			, nc_url_loader(p.instance), nc_url_info(p.instance) {
 			std::string url;
@@ -75,32 +294,26 @@ namespace {
 		}
 	#else
 		{
-			if(FILE* file = fopen(name.c_str(),"rb")) {
-				fseek(file,0,SEEK_END);
-				bytes.resize(ftell(file));
-				fseek(file,0,SEEK_SET);
-				size_t ofs = 0;
-				while(ofs < bytes.size()) {
-					const size_t read = fread(&bytes.at(ofs),1,bytes.size()-ofs,file);
-					if(read <= 0) break;
-					ofs += read;
-				}
-				ok = (ofs == bytes.size());
-				fclose(file);
-			}
-			fire();
+			pimpl.main.get_jobs().submit(this);
 		}
 	#endif
 		main_t::_pimpl_t& pimpl;
 		const std::string name;
 		main_t::file_io_t* const callback;
 		const intptr_t data;
-		bool ok, cancelled;
-		std::string bytes;
+		const main_t::read_mode_t mode;
+		bool ok, cancelled; // cancelled is only touched on the GL thread
+		main_t::bytes_t bytes;
+		void run() { // on a worker
+		#ifndef __native_client__
+			ok = ((mode == main_t::READ_MAP) && map_bytes(name,bytes)) || read_bytes(name,bytes);
+		#endif
+		}
 		void on_fire() {
+			remove();
+			std::auto_ptr<_file_io_impl_t> cleanup(this); // drops our reference to the bytes, even if the callback throws
 			if(!cancelled)
 				callback->on_io(name,ok,bytes,data);
-			remove();
 		}
 		void cancel() {
 			remove();
@@ -127,6 +340,7 @@ namespace {
 				self->nc_url_do_read();
 			}
 		}
+		std::string nc_url_buffer;
 		static void nc_url_read(void* ptr,int32_t code) {
 			_file_io_impl_t* self = static_cast<_file_io_impl_t*>(ptr);
 			if(code > 0) {
@@ -134,8 +348,8 @@ namespace {
 				self->nc_url_do_read();
 				return;
 			} else if(code == 0) {
-				self->bytes.resize(self->nc_url_ofs);
-				self->ok = true;
+				self->nc_url_buffer.resize(self->nc_url_ofs);
+				self->nc_url_done();
 			}
 			self->fire();
 		}
@@ -143,37 +357,139 @@ namespace {
 			enum { bytes_to_read = 1024*4 };
 			int result;
 			for(;;) {
-				bytes.resize(nc_url_ofs+bytes_to_read);
-				result = nc_url_loader.ReadResponseBody(&bytes.at(nc_url_ofs),bytes_to_read,pp::CompletionCallback(nc_url_read,this));
+				nc_url_buffer.resize(nc_url_ofs+bytes_to_read);
+				result = nc_url_loader.ReadResponseBody(&nc_url_buffer.at(nc_url_ofs),bytes_to_read,pp::CompletionCallback(nc_url_read,this));
 				//std::cout << "nc_url_do_read(" << path << ',' << nc_url_ofs << ")=" << result << std::endl;
 				if(result > 0)
 					nc_url_ofs += result;
 				else if(result == PP_OK_COMPLETIONPENDING)
 					return;
 				else if(result == PP_OK) {
-					bytes.resize(nc_url_ofs);
-					ok = true;
+					nc_url_buffer.resize(nc_url_ofs);
+					nc_url_done();
 					break;
 				} else
 					break;
 			}
 			fire();	
 		}
+		void nc_url_done() { // there is no mapping on NaCl; the buffer is handed over without a copy
+			main_t::bytes_t::_buf_t* buf = new main_t::bytes_t::_buf_t();
+			buf->set(nc_url_buffer);
+			bytes = main_t::bytes_t(buf);
+			ok = true;
+		}
 	#endif
 	};
 	
+	/* what SOIL_load_OGL_texture_from_memory(...,SOIL_FLAG_POWER_OF_TWO|SOIL_FLAG_MIPMAPS) does, split so
+	   the decode, resize and mipmapping happen on a worker and only the glTexImage2D calls on the GL thread */
+	struct _decode_job_t: public jobs_t::job_t { // cancelled by its texture if it goes first
+		_decode_job_t(_texture_t& t,const main_t::bytes_t& b,GLint ms): texture(t), bytes(b), max_size(ms), channels(0) {}
+		_texture_t& texture;
+		main_t::bytes_t bytes;
+		const GLint max_size;
+		int channels;
+		struct level_t {
+			int width, height;
+			std::vector<unsigned char> pixels;
+		};
+		std::vector<level_t> levels;
+		void run() {
+			int width, height;
+			unsigned char* img = SOIL_load_image_from_memory(
+				reinterpret_cast<const unsigned char*>(bytes.data()),bytes.size(),
+				&width,&height,&channels,SOIL_LOAD_AUTO);
+			if(!img) return;
+			std::vector<unsigned char> full(img,img+width*height*channels);
+			SOIL_free_image_data(img);
+			int pot_width = 1, pot_height = 1;
+			while(pot_width < width) pot_width *= 2;
+			while(pot_height < height) pot_height *= 2;
+			if(pot_width != width || pot_height != height) {
+				std::vector<unsigned char> resampled(pot_width*pot_height*channels);
+				up_scale_image(&full[0],width,height,channels,&resampled[0],pot_width,pot_height);
+				full.swap(resampled);
+				width = pot_width;
+				height = pot_height;
+			}
+			if(width > max_size || height > max_size) {
+				const int block_x = std::max(width/max_size,1), block_y = std::max(height/max_size,1);
+				std::vector<unsigned char> resampled((width/block_x)*(height/block_y)*channels);
+				mipmap_image(&full[0],width,height,channels,&resampled[0],block_x,block_y);
+				full.swap(resampled);
+				width /= block_x;
+				height /= block_y;
+			}
+			// like SOIL, each mip level is boxed down from the full image rather than from the level above
+			levels.push_back(level_t());
+			levels.back().width = width;
+			levels.back().height = height;
+			for(int level=1, w=(width+1)/2, h=(height+1)/2; ((1<<level) <= width) || ((1<<level) <= height); level++, w=(w+1)/2, h=(h+1)/2) {
+				levels.push_back(level_t());
+				levels.back().width = w;
+				levels.back().height = h;
+				levels.back().pixels.resize(w*h*channels);
+				mipmap_image(&full[0],width,height,channels,&levels.back().pixels[0],1<<level,1<<level);
+			}
+			levels.front().pixels.swap(full);
+		}
+		GLuint upload() const { // on the GL thread
+			if(levels.empty()) return 0;
+			const GLenum format =
+				(channels == 1)? GL_LUMINANCE:
+				(channels == 2)? GL_LUMINANCE_ALPHA:
+				(channels == 3)? GL_RGB: GL_RGBA;
+			GLuint handle = 0;
+			glGenTextures(1,&handle);
+			glBindTexture(GL_TEXTURE_2D,handle);
+			for(size_t level=0; level<levels.size(); level++)
+				glTexImage2D(GL_TEXTURE_2D,level,format,levels[level].width,levels[level].height,0,format,GL_UNSIGNED_BYTE,&levels[level].pixels[0]);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
+		#ifdef GL_CLAMP
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP);
+		#else
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		#endif
+			glCheck();
+			return handle;
+		}
+		void on_fire();
+	};
+
 	struct _texture_t: public main_t::file_io_t, public main_t::callback_t {
-		_texture_t(main_t& m,const std::string& fn): main(m), filename(fn), handle(0), loaded(false) {
-			main.read_file(filename,this,0);
+		_texture_t(main_t& m,const std::string& fn): main(m), filename(fn), decoding(NULL), handle(0), loaded(false) {
+			main.read_file(filename,this,0,main_t::READ_MAP);
 		}
-		void on_io(const std::string& name,bool ok,const std::string& bytes,intptr_t data) {
-			loaded = true;
+		virtual ~_texture_t() {
+			main.cancel_read_file(this,0);
+			if(decoding)
+				main.get_jobs().cancel(decoding);
+			main.remove_callback(this);
+			main.get_asset_registry().release_texture(handle);
+		}
+		void on_io(const std::string& name,bool ok,const main_t::bytes_t& bytes,intptr_t data) {
 			if(ok) {
-				handle = SOIL_load_OGL_texture_from_memory(
-					reinterpret_cast<const unsigned char*>(bytes.c_str()),bytes.size(),
-					SOIL_LOAD_AUTO,
-					SOIL_CREATE_NEW_ID,
-					SOIL_FLAG_POWER_OF_TWO|SOIL_FLAG_MIPMAPS);
+				static GLint max_size = 0;
+				if(!max_size)
+					glGetIntegerv(GL_MAX_TEXTURE_SIZE,&max_size);
+				main.get_jobs().submit(decoding = new _decode_job_t(*this,bytes,max_size));
+			} else
+				on_decoded(NULL);
+		}
+		void on_decoded(const _decode_job_t* job) {
+			decoding = NULL;
+			loaded = true;
+			if(job) {
+				// identical image files under different names share one texture; checked after the decode,
+				// as until then an identical file may still be in flight, but before the upload
+				asset_registry_t& registry = main.get_asset_registry();
+				handle = registry.acquire_texture(GL_TEXTURE_2D,job->bytes.data(),job->bytes.size());
+				if(!handle && (handle = job->upload()))
+					registry.add_texture(GL_TEXTURE_2D,job->bytes.data(),job->bytes.size(),handle);
 			}
 			if(queue.size())
 				main.add_callback(this);
@@ -192,6 +508,7 @@ namespace {
 		}
 		main_t& main;
 		const std::string filename;
+		_decode_job_t* decoding; // until it fires
 		GLuint handle;
 		bool loaded;
 		struct waiting_t {
@@ -204,17 +521,37 @@ namespace {
 		typedef std::vector<waiting_t> queue_t;
 		queue_t queue;
 	};
+
+	void _decode_job_t::on_fire() {
+		std::auto_ptr<_decode_job_t> cleanup(this);
+		texture.on_decoded(this);
+	}
 } // anon namespace
 
+main_t::_pimpl_t::~_pimpl_t() {
+	for(textures_t::iterator t=textures.begin(); t!=textures.end(); t++)
+		delete t->second;
+	while(shared_programs.size())
+		main.delete_program(shared_programs.begin()->second);
+}
+
 bool main_t::_pimpl_t::tick() {
 	main._now = high_precision_time(); 
+	if(jobs.get())
+		jobs->tick();
 	if(callbacks.size()) {
 		callbacks_t cb(callbacks); // from copy
 		callbacks.clear();
 		for(callbacks_t::iterator i=cb.begin(); i!=cb.end(); i++)
 			(*i)->on_fire();
 	}
-	return main.tick();
+	gl_state_t& gl = main.get_gl_state();
+	gl.new_frame(); // the callbacks upload, binding behind its back
+	const bool running = main.tick();
+	if(batch_2d.get())
+		batch_2d->flush();
+	gl.end_frame();
+	return running;
 }
 
 main_t::main_t(void* platform_ptr): width(0), height(0), _pimpl(new _pimpl_t(*this,platform_ptr)) {
@@ -268,92 +605,261 @@ static void glsl_log(GLuint obj,const std::string& src) {
 	}
 }
 
+#ifdef __native_client__
+const char* main_t::program_cache = NULL; // no program binaries in GLES2, nor files to keep them in
+#else
+const char* main_t::program_cache = "program_cache.bin";
+#endif
+
+static const uint32_t PROGRAM_CACHE_MAGIC = 0x50524f47; // "PROG"
+
+bool main_t::_pimpl_t::use_program_binaries() {
+	if(!main_t::program_cache)
+		return false;
+#ifndef __native_client__
+	if(!program_binaries_read) {
+		program_binaries_read = true;
+		GLint formats = 0;
+		if(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS,&formats);
+		glCheck();
+		if(!formats) {
+			main_t::program_cache = NULL;
+			return false;
+		}
+		driver = std::string((const char*)glGetString(GL_VENDOR))+'\n'+(const char*)glGetString(GL_RENDERER)+'\n'+
+			(const char*)glGetString(GL_VERSION)+'\n';
+		// a magic number and count, then each binary's key, format and size, and the binary itself
+		main_t::bytes_t bytes;
+		if(!read_bytes(main_t::program_cache,bytes))
+			return true;
+		const char* p = bytes.data(), *end = p+bytes.size();
+		uint32_t header[2];
+		if(end-p < (ptrdiff_t)sizeof(header)) return true;
+		memcpy(header,p,sizeof(header));
+		p += sizeof(header);
+		if(header[0] != PROGRAM_CACHE_MAGIC) return true;
+		for(uint32_t i=0; i<header[1]; i++) {
+			uint64_t key;
+			uint32_t entry[2]; // format, size
+			if(end-p < (ptrdiff_t)(sizeof(key)+sizeof(entry))) {
+				program_binaries_dirty = true; // truncated, so rewrite it
+				break;
+			}
+			memcpy(&key,p,sizeof(key));
+			memcpy(entry,p+sizeof(key),sizeof(entry));
+			p += sizeof(key)+sizeof(entry);
+			if((uint32_t)(end-p) < entry[1]) {
+				program_binaries_dirty = true;
+				break;
+			}
+			program_binary_t& binary = program_binaries[key];
+			binary.format = entry[0];
+			binary.bytes.assign(p,entry[1]);
+			binary.used = false;
+			p += entry[1];
+		}
+	}
+#endif
+	return true;
+}
+
+void main_t::_pimpl_t::write_program_binaries() {
+	// entries read but not used were made by another driver or from old source; pruning them changes the file too
+	for(program_binaries_t::const_iterator b=program_binaries.begin(); !program_binaries_dirty && b!=program_binaries.end(); b++)
+		program_binaries_dirty = !b->second.used;
+	if(!program_binaries_dirty || !main_t::program_cache)
+		return;
+	program_binaries_dirty = false;
+	std::string out;
+	uint32_t header[2] = {PROGRAM_CACHE_MAGIC,0};
+	out.append((const char*)header,sizeof(header));
+	for(program_binaries_t::iterator b=program_binaries.begin(); b!=program_binaries.end(); ) {
+		if(!b->second.used) { // so they aren't found dirty again
+			program_binaries.erase(b++);
+			continue;
+		}
+		const uint32_t entry[2] = {b->second.format,(uint32_t)b->second.bytes.size()};
+		out.append((const char*)&b->first,sizeof(b->first));
+		out.append((const char*)entry,sizeof(entry));
+		out += b->second.bytes;
+		header[1]++;
+		b++;
+	}
+	memcpy(&out[0],header,sizeof(header));
+	if(FILE* file = fopen(main_t::program_cache,"wb")) {
+		const bool ok = (fwrite(out.data(),1,out.size(),file) == out.size());
+		if(fclose(file) || !ok) {
+			fprintf(stderr,"could not write %s\n",main_t::program_cache);
+			remove(main_t::program_cache); // rather than leave it truncated
+		}
+	} else
+		fprintf(stderr,"could not write %s\n",main_t::program_cache);
+}
+
 GLuint main_t::create_program(const char* vertex,const char* fragment) {
 #ifdef __native_client__
 	const std::string precision("precision lowp float;\n");
 #else
 	const std::string precision;
 #endif
-	const GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-	graphics_assert(vs);
-	glCheck();
-	const std::string vsrc = precision+vertex;
-	const GLchar* vvsrc = vsrc.c_str();
-	glShaderSource(vs,1,&vvsrc,NULL);
-	glCompileShader(vs);
-	glCheck(vsrc.c_str());
-	glsl_log(vs,vsrc);
-	const GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
+	_pimpl_t::linking_t linking = {0,0,0,precision+vertex,precision+fragment,0};
+	linking.program = glCreateProgram();
+	graphics_assert(linking.program);
 	glCheck();
-	const std::string fsrc = precision+fragment;
-	const GLchar* ffsrc = fsrc.c_str();
-	glShaderSource(fs,1,&ffsrc,NULL);
-	glCompileShader(fs);
-	glCheck(fsrc.c_str());
-	glsl_log(fs,fsrc);
-	GLuint program = glCreateProgram();
-	graphics_assert(program);
-	glCheck();
-	glAttachShader(program,vs);
-	glAttachShader(program,fs);
-	glLinkProgram(program);
-	glsl_log(program,vsrc+fsrc);
-	glDeleteShader(vs);
-	glDeleteShader(fs);
+#ifndef __native_client__
+	if(_pimpl->use_program_binaries()) {
+		const std::string key = _pimpl->driver+linking.vsrc+'\n'+linking.fsrc;
+		linking.key = content_hash(key.data(),key.size());
+		_pimpl_t::program_binaries_t::iterator b = _pimpl->program_binaries.find(linking.key);
+		if(b != _pimpl->program_binaries.end()) {
+			// so that the only error left to ignore below is the binary's own
+			glCheck();
+			if(DEBUG_CHECK_GL_ERROR == GL_CHECK_OFF)
+				count_pending_gl_errors();
+			glProgramBinary(linking.program,b->second.format,b->second.bytes.data(),b->second.bytes.size());
+			GLint ok = GL_FALSE;
+			glGetProgramiv(linking.program,GL_LINK_STATUS,&ok);
+			glGetError(); // a rejected binary may also raise an error
+			if(ok) {
+				b->second.used = true;
+				_pimpl->linking.push_back(linking);
+				return linking.program;
+			}
+			// the driver may refuse binaries for any reason; build from source, and cache that instead
+			_pimpl->program_binaries.erase(b);
+		}
+		glProgramParameteri(linking.program,GL_PROGRAM_BINARY_RETRIEVABLE_HINT,GL_TRUE);
+		glCheck();
+	}
+#endif
+	// nothing asks the driver how it went until link_programs(), so drivers that compile
+	// on threads of their own can do every program at once
+	linking.vs = glCreateShader(GL_VERTEX_SHADER);
+	graphics_assert(linking.vs);
+	const GLchar* src = linking.vsrc.c_str();
+	glShaderSource(linking.vs,1,&src,NULL);
+	glCompileShader(linking.vs);
+	glCheck(linking.vsrc.c_str());
+	linking.fs = glCreateShader(GL_FRAGMENT_SHADER);
+	graphics_assert(linking.fs);
+	src = linking.fsrc.c_str();
+	glShaderSource(linking.fs,1,&src,NULL);
+	glCompileShader(linking.fs);
+	glCheck(linking.fsrc.c_str());
+	glAttachShader(linking.program,linking.vs);
+	glAttachShader(linking.program,linking.fs);
+	glLinkProgram(linking.program);
 	glCheck();
-	return program;
+	_pimpl->linking.push_back(linking);
+	return linking.program;
 }
 
-GLint main_t::get_uniform_loc(GLuint prog,const std::string& name,GLenum type,int size) {
-	glCheck();
-	graphics_assert(glIsProgram(prog));
-	GLint loc = glGetUniformLocation(prog,name.c_str());
-	glCheck();
-	if(loc == -1) graphics_error("could not get uniform " << name);
-	GLchar n[100];
-	GLint l;
-	GLint s;
-	GLenum t;
-	GLint num_uniforms = 0; // uniforms and attributes may be in same array :(
-	glGetProgramiv(prog,GL_ACTIVE_UNIFORMS,&num_uniforms);
-	glCheck();
-	for(int idx=0; idx<num_uniforms; idx++) {
-		glGetActiveUniform(prog,idx,sizeof(n),&l,&s,&t,n);
-		glCheck();
-		if(name == n) {
-			graphics_assert(!type || (type == t));
-			graphics_assert(size == s);
-			return loc;
+void main_t::link_programs() {
+	_pimpl_t::linkings_t linking;
+	linking.swap(_pimpl->linking);
+	for(_pimpl_t::linkings_t::iterator l=linking.begin(); l!=linking.end(); l++) {
+		if(l->vs) {
+			glsl_log(l->vs,l->vsrc);
+			glsl_log(l->fs,l->fsrc);
+			glsl_log(l->program,l->vsrc+l->fsrc);
+			glDeleteShader(l->vs);
+			glDeleteShader(l->fs);
+			glCheck();
+		#ifndef __native_client__
+			if(l->key) {
+				GLint len = 0;
+				glGetProgramiv(l->program,GL_PROGRAM_BINARY_LENGTH,&len);
+				_pimpl_t::program_binary_t& binary = _pimpl->program_binaries[l->key];
+				binary.bytes.resize(len);
+				GLsizei got = 0;
+				if(len)
+					glGetProgramBinary(l->program,len,&got,&binary.format,&binary.bytes[0]);
+				if(got) {
+					binary.bytes.resize(got);
+					binary.used = true;
+					_pimpl->program_binaries_dirty = true;
+				} else
+					_pimpl->program_binaries.erase(l->key);
+				glCheck();
+			}
+		#endif
 		}
+		_pimpl->reflect(l->program);
 	}
-	graphics_error(name.c_str());
-	return loc; // dumb compiler
+	_pimpl->write_program_binaries();
 }
 
-GLint main_t::get_attribute_loc(GLuint prog,const std::string& name,GLenum type,int size) {
-	glCheck();
-	graphics_assert(glIsProgram(prog));
-	GLint loc = glGetAttribLocation(prog,name.c_str());
-	glCheck();
-	if(loc == -1) graphics_error("could not get attribute " << name);
+main_t::_pimpl_t::reflection_t& main_t::_pimpl_t::reflect(GLuint program) {
+	reflections_t::iterator r = reflections.find(program);
+	if(r == reflections.end() && !linking.empty()) {
+		main.link_programs(); // it may be one of them
+		r = reflections.find(program);
+	}
+	if(r != reflections.end())
+		return r->second;
+	graphics_assert(glIsProgram(program));
+	reflection_t reflection;
 	GLchar n[100];
-	GLint l;
-	GLint s;
-	GLenum t;
-	GLint num_attributes = 0; // uniforms and attributes may be in same array :(
-	glGetProgramiv(prog,GL_ACTIVE_ATTRIBUTES,&num_attributes);
+	GLsizei l;
+	program_var_t var;
+	GLint count = 0;
+	glGetProgramiv(program,GL_ACTIVE_UNIFORMS,&count);
 	glCheck();
-	for(int idx=0; idx<num_attributes; idx++) {
-		glGetActiveAttrib(prog,idx,sizeof(n),&l,&s,&t,n);
+	for(int idx=0; idx<count; idx++) {
+		glGetActiveUniform(program,idx,sizeof(n),&l,&var.size,&var.type,n);
+		var.loc = glGetUniformLocation(program,n);
 		glCheck();
-		if(name == n) {
-			graphics_assert(!type || (type == t));
-			graphics_assert(size == s);
-			return loc;
-		}
+		reflection.uniforms[n] = var;
 	}
-	graphics_error(name.c_str());
-	return loc; // dumb compiler
+	count = 0;
+	glGetProgramiv(program,GL_ACTIVE_ATTRIBUTES,&count);
+	glCheck();
+	for(int idx=0; idx<count; idx++) {
+		glGetActiveAttrib(program,idx,sizeof(n),&l,&var.size,&var.type,n);
+		var.loc = glGetAttribLocation(program,n);
+		glCheck();
+		reflection.attributes[n] = var;
+	}
+	return reflections[program] = reflection;
+}
+
+GLint main_t::_pimpl_t::find(const program_vars_t& vars,const char* kind,const std::string& name,GLenum type,int size) {
+	program_vars_t::const_iterator v = vars.find(name);
+	if(v == vars.end() || v->second.loc == -1) graphics_error("could not get " << kind << " " << name);
+	if(DEBUG_CHECK_GL_ERROR != GL_CHECK_OFF) {
+		graphics_assert(!type || (type == v->second.type));
+		graphics_assert(size == v->second.size);
+	}
+	return v->second.loc;
+}
+
+void main_t::delete_program(GLuint prog) {
+	for(_pimpl_t::linkings_t::iterator l=_pimpl->linking.begin(); l!=_pimpl->linking.end(); l++)
+		if(l->program == prog) {
+			if(l->vs) {
+				glDeleteShader(l->vs);
+				glDeleteShader(l->fs);
+			}
+			_pimpl->linking.erase(l);
+			break;
+		}
+	_pimpl->reflections.erase(prog);
+	for(_pimpl_t::shared_programs_t::iterator s=_pimpl->shared_programs.begin(); s!=_pimpl->shared_programs.end(); )
+		if(s->second == prog)
+			_pimpl->shared_programs.erase(s++);
+		else
+			s++;
+	get_gl_state().delete_program(prog);
+	glCheck();
+}
+
+GLint main_t::get_uniform_loc(GLuint prog,const std::string& name,GLenum type,int size) {
+	return _pimpl->find(_pimpl->reflect(prog).uniforms,"uniform",name,type,size);
+}
+
+GLint main_t::get_attribute_loc(GLuint prog,const std::string& name,GLenum type,int size) {
+	return _pimpl->find(_pimpl->reflect(prog).attributes,"attribute",name,type,size);
 }
 
 void main_t::add_callback(callback_t* callback) {
@@ -367,10 +873,10 @@ void main_t::remove_callback(callback_t* callback) {
 		_pimpl->callbacks.erase(i);
 }
 
-void main_t::read_file(const std::string& name,file_io_t* callback,intptr_t data) {
+void main_t::read_file(const std::string& name,file_io_t* callback,intptr_t data,read_mode_t mode) {
 	for(_pimpl_t::file_io_impls_t::iterator i=_pimpl->file_io_impls.begin(); i!=_pimpl->file_io_impls.end(); i++)
 		assert(!(((*i)->callback == callback) && ((*i)->data == data)));
-	_pimpl->file_io_impls.push_back(new _file_io_impl_t(*_pimpl,name,callback,data));
+	_pimpl->file_io_impls.push_back(new _file_io_impl_t(*_pimpl,name,callback,data,mode));
 }
 
 void main_t::cancel_read_file(file_io_t* callback,intptr_t data) {
@@ -423,9 +929,41 @@ GLuint main_t::set_shared_program(const std::string& name,GLuint handle) {
 	return handle;
 }
 
+buffer_arena_t& main_t::get_buffer_arena(GLenum target) {
+	_pimpl_t::buffer_arenas_t::iterator i = _pimpl->buffer_arenas.find(target);
+	if(i == _pimpl->buffer_arenas.end())
+		i = _pimpl->buffer_arenas.insert(std::make_pair(target,new buffer_arena_t(target))).first;
+	return *i->second;
+}
+
+asset_registry_t& main_t::get_asset_registry() {
+	if(!_pimpl->asset_registry.get())
+		_pimpl->asset_registry.reset(new asset_registry_t(*this));
+	return *_pimpl->asset_registry;
+}
+
+gl_state_t& main_t::get_gl_state() {
+	if(!_pimpl->gl_state.get())
+		_pimpl->gl_state.reset(new gl_state_t());
+	return *_pimpl->gl_state;
+}
+
+batch_2d_t& main_t::get_batch_2d() {
+	if(!_pimpl->batch_2d.get())
+		_pimpl->batch_2d.reset(new batch_2d_t(*this));
+	return *_pimpl->batch_2d;
+}
+
+jobs_t& main_t::get_jobs() {
+	if(!_pimpl->jobs.get())
+		_pimpl->jobs.reset(new jobs_t(*this,(jobs_t::requested_workers < 0)? jobs_t::cpu_count(): jobs_t::requested_workers));
+	return *_pimpl->jobs;
+}
+
 #ifdef __native_client__
 
-main_t::_pimpl_t::_pimpl_t(main_t& m,void* instance_ptr): main(m), instance(static_cast<pp::Instance*>(instance_ptr)) {}
+main_t::_pimpl_t::_pimpl_t(main_t& m,void* instance_ptr): main(m),
+	program_binaries_read(false), program_binaries_dirty(false), instance(static_cast<pp::Instance*>(instance_ptr)) {}
 
 struct _platform_main_t: public pp::Instance {
 public:
@@ -611,7 +1149,7 @@ namespace pp {
 
 #else
 
-main_t::_pimpl_t::_pimpl_t(main_t& m,void*): main(m) {}
+main_t::_pimpl_t::_pimpl_t(main_t& m,void*): main(m), program_binaries_read(false), program_binaries_dirty(false) {}
 
 struct _platform_main_t {
 	_platform_main_t(main_t& m): main(m) {}
@@ -706,12 +1244,29 @@ bool _platform_main_t::event(const SDL_Event& sdl) {
 int main(int argc,char** args) {
 	fprintf(stderr,"%s (c) William Edwards, 2012.  All rights reserved.\n",main_t::game_name);
 	fprintf(stderr,"(built %s, %s)\n",build_timestamp,git_info);
+	gl_check_t gl_check = DEBUG_CHECK_GL_ERROR;
+	for(int i=1; i<argc; i++)
+		if(!strcmp(args[i],"--workers") && i+1<argc) // 0 loads everything on the GL thread
+			jobs_t::requested_workers = atoi(args[++i]);
+		else if(!strcmp(args[i],"--no-program-cache"))
+			main_t::program_cache = NULL;
+		else if(!strcmp(args[i],"--gl-errors") && i+1<argc) { // off, async or sync
+			const char* mode = args[++i];
+			if(!strcmp(mode,"off")) gl_check = GL_CHECK_OFF;
+			else if(!strcmp(mode,"async")) gl_check = GL_CHECK_ASYNC;
+			else if(!strcmp(mode,"sync")) gl_check = GL_CHECK_SYNC;
+			else {
+				fprintf(stderr,"--gl-errors is off, async or sync, not %s\n",mode);
+				return EXIT_FAILURE;
+			}
+		}
 	if(SDL_Init(SDL_INIT_VIDEO)) {
 		fprintf(stderr,"Unable to initialise SDL: %s\n",SDL_GetError());
 		return EXIT_FAILURE;
 	}
 	atexit(SDL_Quit);
 	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER,1);
+	SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE,8); // for debug visualisations, as on NaCl
 	SDL_Surface* window = SDL_SetVideoMode(800,600,24,SDL_OPENGL|SDL_VIDEORESIZE);
 	if(!window) {
 		fprintf(stderr,"Unable to create SDL window: %s\n",SDL_GetError());
@@ -722,6 +1277,7 @@ int main(int argc,char** args) {
 		fprintf(stderr,"Cannot initialise GLEW: %s\n",glewGetErrorString(glew_err));
 		return EXIT_FAILURE;
 	}
+	set_gl_check(gl_check);
 	SDL_WM_SetCaption(main_t::game_name,main_t::game_name);
 	std::auto_ptr<main_t> main(main_t::create(NULL,argc,args));
 	main->init();
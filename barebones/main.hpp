@@ -21,6 +21,11 @@
 #endif
 
 struct _platform_main_t;
+class buffer_arena_t;
+class asset_registry_t;
+class jobs_t;
+class gl_state_t;
+class batch_2d_t;
 
 class main_t {
 	friend struct _platform_main_t;
@@ -37,14 +42,43 @@ public:
 	uint64_t now() const { return _now; }
 	double now_secs() const { return (double)_now / 1000000000; }
 	// graphics utils
+	// create_program() starts compiling and linking, or loads a cached binary, without waiting for the driver;
+	// link_programs(), or the first get_*_loc() on any of them, waits for them all and reports errors
 	GLuint create_program(const char* vertex,const char* fragment);
+	void link_programs();
+	static const char* program_cache; // file linked program binaries are kept in between runs; NULL for none
+	void delete_program(GLuint prog); // and forget it, shared or not; main_t deletes those still shared when it goes
+	// the type and size, where given, are checked unless DEBUG_CHECK_GL_ERROR is GL_CHECK_OFF
 	GLint get_uniform_loc(GLuint prog,const std::string& name,GLenum type=0,int size=1); 
 	GLint get_attribute_loc(GLuint prog,const std::string& name,GLenum type=0,int size=1);
 	// file io
+	struct file_io_t;
+	class bytes_t { // read-only view of a file's contents; copies share it, and it is freed or unmapped with the last copy
+	public:
+		struct _buf_t;
+		bytes_t(): buf(NULL) {}
+		explicit bytes_t(_buf_t* buf); // takes the buffer's initial reference
+		bytes_t(const bytes_t& copy);
+		~bytes_t() { release(); }
+		bytes_t& operator=(const bytes_t& copy);
+		const char* data() const;
+		size_t size() const;
+		std::string str() const; // a copy
+		void release(); // drop this reference early
+	private:
+		friend struct file_io_t;
+		_buf_t* buf;
+	};
+	enum read_mode_t {
+		READ_COPY, // read into memory
+		READ_MAP, // memory-map the file where the platform can, else READ_COPY
+	};
 	struct file_io_t {
-		virtual void on_io(const std::string& name,bool ok,const std::string& bytes,intptr_t data) = 0;
+		// the bytes are valid for the duration of the callback, or for as long as you keep a copy of them
+		virtual void on_io(const std::string& name,bool ok,const bytes_t& bytes,intptr_t data); // calls the std::string version
+		virtual void on_io(const std::string& name,bool ok,const std::string& bytes,intptr_t data);
 	};
-	void read_file(const std::string& name,file_io_t* callback,intptr_t data);
+	void read_file(const std::string& name,file_io_t* callback,intptr_t data,read_mode_t mode=READ_COPY);
 	void cancel_read_file(file_io_t* callback,intptr_t data);
 	static std::string relpath(const std::string& base,const std::string& path);
 	// shared textures
@@ -56,6 +90,16 @@ public:
 	// shared shader programs
 	GLuint get_shared_program(const std::string& name);
 	GLuint set_shared_program(const std::string& name,GLuint handle);
+	// shared buffer arenas, one per target, for static vertex and index arrays
+	buffer_arena_t& get_buffer_arena(GLenum target);
+	// content-addressed sharing of buffers and textures
+	asset_registry_t& get_asset_registry();
+	// worker threads that files are read and textures decoded on; see jobs.hpp
+	jobs_t& get_jobs();
+	// what our draws have bound, so binding it again is skipped; see gl_state.hpp
+	gl_state_t& get_gl_state();
+	// lines and quads drawn together at the end of the frame; see batch_2d.hpp
+	batch_2d_t& get_batch_2d();
 	// main loop
 	virtual bool tick() = 0; // called after event handlers
 	// async callbacks on next loop, called before event handlers and before tick()
@@ -135,10 +179,31 @@ protected:
 	if(GL_NO_ERROR != glGetError()) \
 		graphics_error(#__VA_ARGS__); \
 }
-extern bool DEBUG_CHECK_GL_ERROR; // default to FALSE in NaCl
+enum gl_check_t {
+	GL_CHECK_OFF, // but gl_state_t::new_frame() counts what glGetError() has, once a frame
+	GL_CHECK_ASYNC, // errors are logged as the driver reports them, against the last glCheck() passed, and aren't thrown
+	GL_CHECK_SYNC // glGetError() at every glCheck(), which waits on the pipeline
+};
+extern gl_check_t DEBUG_CHECK_GL_ERROR; // default to GL_CHECK_OFF in NaCl and release builds
+void set_gl_check(gl_check_t mode); // needs a context; GL_CHECK_ASYNC needs ARB_debug_output, else is GL_CHECK_SYNC
+struct gl_check_site_t {
+	const char* file;
+	int line;
+};
+extern const gl_check_site_t* volatile gl_check_site; // the last glCheck() passed, for GL_CHECK_ASYNC; one store, so read whole
+void count_gl_error();
+void count_pending_gl_errors(); // glGetError() until there are none, counting each; what GL_CHECK_OFF has instead of glCheck()
+size_t take_gl_errors(); // counted since last taken
 #define glCheck(...) { \
-	if(DEBUG_CHECK_GL_ERROR && (GL_NO_ERROR != glGetError())) \
-		graphics_error(#__VA_ARGS__); \
+	if(DEBUG_CHECK_GL_ERROR == GL_CHECK_SYNC) { \
+		if(GL_NO_ERROR != glGetError()) { \
+			count_gl_error(); \
+			graphics_error(#__VA_ARGS__); \
+		} \
+	} else if(DEBUG_CHECK_GL_ERROR == GL_CHECK_ASYNC) { \
+		static const gl_check_site_t site = {__FILE__,__LINE__}; \
+		gl_check_site = &site; \
+	} \
 }
 
 class data_error_t: public std::exception {
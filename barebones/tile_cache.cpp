@@ -0,0 +1,149 @@
+#include "tile_cache.hpp"
+#include "gl_state.hpp"
+#include "../external/ogl-math/glm/gtc/type_ptr.hpp"
+
+tile_cache_t::tile_cache_t(main_t& m,painter_t& p,int ts,size_t mt):
+	main(m), painter(p), tile_size(ts), max_tiles(mt), depth_buffer(0), vbo(0), frame(0) {
+	if(!supported()) panic("framebuffer objects are not supported");
+	if(tile_size <= 0) panic("tile size " << tile_size);
+	program = main.get_shared_program("tile_cache");
+	graphics_assert(program && "tile_cache"); // provided by game adaptation
+	uniform_mvp_matrix = main.get_uniform_loc(program,"MVP_MATRIX",GL_FLOAT_MAT4);
+	attrib_vertex = main.get_attribute_loc(program,"VERTEX",GL_FLOAT_VEC3);
+	attrib_tex = main.get_attribute_loc(program,"TEX_COORD_0",GL_FLOAT_VEC2);
+	main.get_gl_state().use_program(program);
+	glUniform1i(main.get_uniform_loc(program,"TEX_UNIT_0"),0);
+	glGenRenderbuffers(1,&depth_buffer);
+	glBindRenderbuffer(GL_RENDERBUFFER,depth_buffer);
+	glRenderbufferStorage(GL_RENDERBUFFER,GL_DEPTH_COMPONENT16,tile_size,tile_size);
+	glBindRenderbuffer(GL_RENDERBUFFER,0);
+	glGenBuffers(1,&vbo);
+	glCheck();
+}
+
+tile_cache_t::~tile_cache_t() {
+	main.get_gl_state().bind_texture(0,0); // so a new texture given a deleted one's name is bound
+	for(tiles_t::iterator t=tiles.begin(); t!=tiles.end(); t++) {
+		glDeleteFramebuffers(1,&t->second.framebuffer);
+		glDeleteTextures(1,&t->second.texture);
+	}
+	glDeleteRenderbuffers(1,&depth_buffer);
+	main.get_gl_state().delete_buffer(vbo);
+}
+
+bool tile_cache_t::supported() {
+#ifdef __native_client__
+	return true; // core in GLES2
+#else
+	return GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object;
+#endif
+}
+
+void tile_cache_t::draw(const glm::mat4& projection,const glm::vec2& view_min,const glm::vec2& view_max,float z) {
+	_stats.paints = _stats.draws = 0;
+	frame++;
+	const int x0 = floor(view_min.x/tile_size), y0 = floor(view_min.y/tile_size),
+		x1 = floor(view_max.x/tile_size), y1 = floor(view_max.y/tile_size);
+	// paint first, as painting leaves the program and bindings the painter's
+	std::vector<tile_t*> shown;
+	quads.clear();
+	for(int y=y0; y<=y1; y++)
+		for(int x=x0; x<=x1; x++) {
+			const tile_key_t key(x,y);
+			tile_t& tile = tiles[key];
+			if(!tile.painted)
+				paint(key,tile);
+			tile.last_drawn = frame;
+			shown.push_back(&tile);
+			const GLfloat l = x*tile_size, b = y*tile_size, r = l+tile_size, t = b+tile_size;
+			const GLfloat quad[4*5] = {
+				l,b,z, 0,0,
+				r,b,z, 1,0,
+				l,t,z, 0,1,
+				r,t,z, 1,1};
+			quads.insert(quads.end(),quad,quad+4*5);
+		}
+	gl_state_t& gl = main.get_gl_state();
+	gl.use_program(program);
+	glUniformMatrix4fv(uniform_mvp_matrix,1,false,glm::value_ptr(projection));
+	gl.bind_buffer(GL_ARRAY_BUFFER,vbo);
+	glBufferData(GL_ARRAY_BUFFER,quads.size()*sizeof(GLfloat),&quads[0],GL_STREAM_DRAW);
+	gl.use_attribs(gl_state_t::attrib_bit(attrib_vertex)|gl_state_t::attrib_bit(attrib_tex));
+	glVertexAttribPointer(attrib_vertex,3,GL_FLOAT,GL_FALSE,5*sizeof(GLfloat),0);
+	glVertexAttribPointer(attrib_tex,2,GL_FLOAT,GL_FALSE,5*sizeof(GLfloat),(GLvoid*)(3*sizeof(GLfloat)));
+	glDepthMask(GL_FALSE); // what is drawn later is in front, whatever its depth
+	for(size_t i=0; i<shown.size(); i++) {
+		gl.bind_texture(0,shown[i]->texture);
+		gl.draw_arrays(GL_TRIANGLE_STRIP,i*4,4);
+		_stats.draws++;
+	}
+	glDepthMask(GL_TRUE);
+	glCheck();
+	evict();
+	_stats.tiles = tiles.size();
+}
+
+void tile_cache_t::paint(const tile_key_t& key,tile_t& tile) {
+	gl_state_t& gl = main.get_gl_state();
+	if(!tile.texture) {
+		glGenTextures(1,&tile.texture);
+		gl.bind_texture(0,tile.texture);
+		glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA,tile_size,tile_size,0,GL_RGBA,GL_UNSIGNED_BYTE,NULL);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST); // a texel to the world unit
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+		glGenFramebuffers(1,&tile.framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER,tile.framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_TEXTURE_2D,tile.texture,0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER,depth_buffer);
+		const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if(status != GL_FRAMEBUFFER_COMPLETE) {
+			glBindFramebuffer(GL_FRAMEBUFFER,0);
+			graphics_error("tile framebuffer is incomplete (" << status << ")");
+		}
+		glCheck();
+	} else
+		glBindFramebuffer(GL_FRAMEBUFFER,tile.framebuffer);
+	gl.bind_texture(0,0); // not sampled while painted into
+	GLfloat clear_colour[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE,clear_colour);
+	glViewport(0,0,tile_size,tile_size);
+	glClearColor(0,0,0,0);
+	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+	const glm::vec2 min(key.first*tile_size,key.second*tile_size);
+	painter.paint_tile(min,min+glm::vec2(tile_size,tile_size));
+	tile.painted = true;
+	glBindFramebuffer(GL_FRAMEBUFFER,0);
+	glViewport(0,0,main.w(),main.h());
+	glClearColor(clear_colour[0],clear_colour[1],clear_colour[2],clear_colour[3]);
+	glCheck();
+	_stats.paints++;
+}
+
+void tile_cache_t::invalidate(const glm::vec2& min,const glm::vec2& max) {
+	const int x0 = floor(min.x/tile_size), y0 = floor(min.y/tile_size),
+		x1 = floor(max.x/tile_size), y1 = floor(max.y/tile_size);
+	for(tiles_t::iterator t=tiles.begin(); t!=tiles.end(); t++)
+		if(t->first.first >= x0 && t->first.first <= x1 && t->first.second >= y0 && t->first.second <= y1)
+			t->second.painted = false;
+}
+
+void tile_cache_t::invalidate() {
+	for(tiles_t::iterator t=tiles.begin(); t!=tiles.end(); t++)
+		t->second.painted = false;
+}
+
+void tile_cache_t::evict() {
+	while(tiles.size() > max_tiles) {
+		tiles_t::iterator oldest = tiles.end();
+		for(tiles_t::iterator t=tiles.begin(); t!=tiles.end(); t++)
+			if(t->second.last_drawn != frame && (oldest == tiles.end() || t->second.last_drawn < oldest->second.last_drawn))
+				oldest = t;
+		if(oldest == tiles.end()) return; // all on screen
+		main.get_gl_state().bind_texture(0,0); // so a new texture given a deleted one's name is bound
+		glDeleteFramebuffers(1,&oldest->second.framebuffer);
+		glDeleteTextures(1,&oldest->second.texture);
+		tiles.erase(oldest);
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef __TILE_CACHE_HPP__
+#define __TILE_CACHE_HPP__
+
+#include "main.hpp"
+#include "../external/ogl-math/glm/glm.hpp"
+#include <map>
+
+/* a layer of the world that doesn't change, painted once into square textures ("tiles") a world
+   unit to the texel, and thereafter drawn as one textured quad per tile on screen.  Tiles are
+   painted when first seen and again after being invalidated; the least recently drawn are
+   dropped beyond max_tiles.  Needs framebuffer objects (GL 3, ARB_framebuffer_object or GLES2),
+   and the game adaptation to provide a "tile_cache" program */
+class tile_cache_t {
+public:
+	struct painter_t {
+		// draw the layer between min and max, the tile's corners, into the bound framebuffer, which is cleared to transparent
+		virtual void paint_tile(const glm::vec2& min,const glm::vec2& max) = 0;
+	};
+	enum { DEFAULT_TILE_SIZE = 256, DEFAULT_MAX_TILES = 64 };
+	tile_cache_t(main_t& main,painter_t& painter,int tile_size=DEFAULT_TILE_SIZE,size_t max_tiles=DEFAULT_MAX_TILES);
+	~tile_cache_t();
+	static bool supported();
+	// paint the tiles overlapping the view that need it, then draw them at z, not writing depth
+	void draw(const glm::mat4& projection,const glm::vec2& view_min,const glm::vec2& view_max,float z);
+	void invalidate(const glm::vec2& min,const glm::vec2& max); // tiles overlapping this are painted again
+	void invalidate(); // all of them
+	main_t& main;
+	painter_t& painter;
+	const int tile_size;
+	const size_t max_tiles;
+	struct stats_t {
+		stats_t(): tiles(0), paints(0), draws(0) {}
+		size_t tiles; // live
+		size_t paints, draws; // by the last draw()
+	};
+	const stats_t& stats() const { return _stats; }
+private:
+	struct tile_t {
+		tile_t(): texture(0), framebuffer(0), painted(false), last_drawn(0) {}
+		GLuint texture, framebuffer;
+		bool painted;
+		size_t last_drawn;
+	};
+	typedef std::pair<int,int> tile_key_t; // in tiles from the origin
+	typedef std::map<tile_key_t,tile_t> tiles_t;
+	tiles_t tiles;
+	void paint(const tile_key_t& key,tile_t& tile);
+	void evict();
+	GLuint depth_buffer, vbo; // the depth buffer is shared by every tile's framebuffer, being needed only while painting
+	GLuint program, uniform_mvp_matrix, attrib_vertex, attrib_tex;
+	size_t frame;
+	std::vector<GLfloat> quads;
+	stats_t _stats;
+};
+
+#endif//__TILE_CACHE_HPP__
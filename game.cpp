@@ -1,5 +1,6 @@
 #include <iostream>
 #include <map>
+#include <set>
 #include <memory>
 
 #ifndef __native_client__
@@ -10,11 +11,23 @@
 #include "barebones/rand.hpp"
 #include "barebones/xml.hpp"
 #include "barebones/g3d.hpp"
+#include "barebones/g3d_batch.hpp"
+#include "barebones/tile_cache.hpp"
+#include "barebones/asset_registry.hpp"
+#include "barebones/jobs.hpp"
+#include "barebones/gl_state.hpp"
+#include "barebones/batch_2d.hpp"
 #include "external/ogl-math/glm/gtx/transform.hpp"
 
 #include "paths.hpp"
 
 int DEBUG_LEVEL = 0; // default to 0 for release
+bool QUANTISE_G3D = false; // game.xml quantise_g3d="true" halves the GL memory of models
+bool FRAME_TEXTURES_G3D = false; // game.xml frame_textures_g3d="true" animates models from textures where the GL can
+float DECIMATE_G3D = 0; // game.xml decimate_g3d="0.002" drops frames lerping reproduces to within that fraction of a model's size
+float LOD_G3D = 0; // game.xml lod_g3d="0.05" builds levels of detail off by up to that fraction of a model's size
+bool STATIC_BATCH = true; // game.xml static_batch="false" draws the background model by model in play too
+bool TILE_CACHE = false; // game.xml tile_cache="true" draws the background from textures painted once, where the GL can
 
 void create_shaders(main_t& main); // shaders.cpp
 
@@ -51,11 +64,13 @@ struct rect_t {
 		return ret;
 	}
 	void draw(main_t& main,const glm::mat4& mvp,glm::vec4 colour);
+	void fill(main_t& main,const glm::mat4& mvp,glm::vec4 colour);
+	static const float Z; // in front of the world
 };
 
-class main_game_t: public main_t, private main_t::file_io_t {
+class main_game_t: public main_t, private main_t::file_io_t, private tile_cache_t::painter_t {
 public:
-	main_game_t(void* platform_ptr): main_t(platform_ptr),
+	main_game_t(void* platform_ptr): main_t(platform_ptr), show_overdraw(false),
 		mode(MODE_LOAD), active_model(NULL), active_object(NULL), player(NULL), 
 		bridge_broken(false), won(false), exit(false), exited(false),
 		mouse_down(false) {}
@@ -75,7 +90,21 @@ private:
 	bool is_ready() const;
 	void save();
 	void play();
+	void start_play(); // from the splash screen
 	void play_tick(float step);
+	void prefetch(const rect_t& area);
+	// objects are queued as they are drawn and then drawn together, artwork by artwork, so each
+	// artwork can draw all of its at once
+	typedef std::vector<std::pair<artwork_t*,g3d_t::instances_t> > draw_queue_t;
+	draw_queue_t draw_queue;
+	void queue_draw(artwork_t* artwork,float time,const glm::mat4& modelview,const glm::vec4& colour);
+	// the opaque nearest first without blending, then the background, then the translucent farthest first
+	void draw_queued(const glm::mat4& projection,const glm::vec3& light0);
+	static bool is_opaque(const g3d_t::instance_t& instance) { return instance.colour.a >= 1; }
+	static bool nearest_first(const draw_queue_t::value_type& a,const draw_queue_t::value_type& b);
+	static bool farthest_first(const draw_queue_t::value_type& a,const draw_queue_t::value_type& b);
+	bool show_overdraw; // tint each pixel by how many times it was drawn to
+	bool toggle_debug_view(short code); // 'l' LOD colours and 'd' overdraw; in play too, with debug_level
 	artwork_t* load_asset(xml_walker_t& xml,artwork_t* parent=NULL);
 	enum {
 		LOAD_GAME_XML,
@@ -102,6 +131,11 @@ private:
 	object_t* active_object;
 	glm::vec2 pan_rate, active_object_anchor;
 	object_t* player, *balrog;
+	bool is_static_back(object_t& object) const; // background that can be batched or cached
+	void paint_tile(const glm::vec2& min,const glm::vec2& max);
+	void invalidate_tiles(object_t& object); // before and after the editor changes it
+	std::auto_ptr<g3d_batch_t> static_batch; // the background, made by start_play()
+	std::auto_ptr<tile_cache_t> tile_cache; // the background, if TILE_CACHE
 	rect_t screen;
 	struct hot_t: public rect_t {
 		hot_t(): type(BAD) {}
@@ -120,10 +154,15 @@ private:
 	bool draw_hot;
 	bool mouse_down;
 	float mouse_x, mouse_y;
-	static const float PAN_RATE;
+	uint64_t load_started; // for the startup time
+	static const float PAN_RATE, PREFETCH_MARGIN, STATIC_BATCH_CHUNK;
+	static const glm::vec3 LIGHT_0;
 };
 
 const float main_game_t::PAN_RATE = 800; // px/sec
+const float main_game_t::PREFETCH_MARGIN = 800; // px beyond the screen at which objects start loading all their animations
+const float main_game_t::STATIC_BATCH_CHUNK = 1024; // px square of background merged together
+const glm::vec3 main_game_t::LIGHT_0(10,10,10);
 
 struct main_game_t::artwork_t {
 	enum class_t {
@@ -144,8 +183,15 @@ struct main_game_t::artwork_t {
 	const float attack_points, health_points, attack_range, defend_range;
 	virtual void draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light0,const glm::vec4& colour = glm::vec4(1,1,1,1)) = 0;
 	virtual void draw(const rect_t& rect,const glm::mat4& projection,const glm::vec4& colour = glm::vec4(1,1,1,1)) {} // for splash etc
+	// draw later with everything else queued of the same artwork
+	virtual void queue(float time,const glm::mat4& modelview,const glm::vec4& colour) { game.queue_draw(this,time,modelview,colour); }
+	virtual void draw_instances(const g3d_t::instances_t& instances,const glm::mat4& projection,const glm::vec3& light0) {
+		for(g3d_t::instances_t::const_iterator i=instances.begin(); i!=instances.end(); i++)
+			draw(i->time,projection,i->modelview,light0,i->colour);
+	}
 	virtual artwork_t* get_child(const std::string& id) = 0;
 	virtual void bounds(glm::vec3& min,glm::vec3& max) = 0;
+	virtual void pose_bounds(float time,glm::vec3& min,glm::vec3& max) { bounds(min,max); } // of what draw(time) draws
 	rect_t rect() {
 		if(!_bounds && is_ready()) {
 			glm::vec3 min, max;
@@ -164,18 +210,28 @@ struct main_game_t::artwork_t {
 				p = p->parent;
 			}
 			_rect.normalise();
-			_bounds = true;
+			_bounds = is_loaded(); // a set's bounds grow as its children arrive
 		}
 		return _rect;
 	}
 	virtual void save(std::stringstream& xml) = 0;
-	virtual bool is_ready() = 0;
+	virtual bool is_ready() = 0; // what has been asked for has loaded
+	virtual bool is_loaded() { return is_ready(); } // and so has everything else
+	virtual bool is_requested() { return true; }
+	virtual void prefetch() {} // ask for everything
+	virtual artwork_t* placeholder() { return this; } // to draw while a child loads
+	// a model whose every pose is the same, for batching and caching; sets animate, so aren't
+	virtual g3d_t* static_g3d() { return NULL; }
+	virtual void discard_cpu_copy() {} // once there's no more batching to do
 	float effective_animation_length() const { return animation_length? animation_length: 2; }
 protected:
 	void on_ready(bool ok) {
 		if(!ok) data_error("failed to load " << id);
 		game.on_ready(this);
 	}
+	bool retain_for_batch() const { // the background keeps its arrays for start_play() to batch
+		return STATIC_BATCH && cls == CLS_BACK && !parent && !game.static_batch.get();
+	}
 	artwork_t(main_game_t& g,artwork_t* p,const std::string& id_,const std::string& n,class_t c,float sf,
 		const glm::vec3& a,float sp,float al,float ap,float hp,float ar,float dr):
 		game(g), parent(p), id(id_), name(n), cls(c),
@@ -201,41 +257,16 @@ struct artwork_splash_t: public main_game_t::artwork_t, private main_t::texture_
 		texture = handle;
 		if(!is_ready())
 			data_error("could not load splash " << id << ':' << path);
+		on_ready(true); // images decode in parallel with models, so this may be the last to load
 	}
 	bool is_ready() { return texture; }
 	void draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light0,const glm::vec4& colour) {}
 	void draw(const rect_t& rect,const glm::mat4& projection,const glm::vec4& colour) {
 		if(!is_ready()) return;
+		// projected here, and drawn at the near plane
 		const glm::vec4 bl = projection * glm::vec4(rect.bl,0,1), tr = projection * glm::vec4(rect.tr,0,1);
-		const float x1 = bl.x, y1 = bl.y, x2 = tr.x, y2 = tr.y;
-		const GLfloat data[4*2+4*2] = {
-			x1,y1,x2,y1,x1,y2,x2,y2,
-			0,1,1,1,0,0,1,0};
-		GLuint program = game.get_shared_program("splash"),
-			uniform_colour = game.get_uniform_loc(program,"COLOUR",GL_FLOAT_VEC4),
-			attrib_vertex = game.get_attribute_loc(program,"VERTEX",GL_FLOAT_VEC2),
-			attrib_tex = game.get_attribute_loc(program,"TEX_COORD_0",GL_FLOAT_VEC2),
-			vbo;
-		glUseProgram(program);
-		glUniform4fv(uniform_colour,1,glm::value_ptr(colour));
-		glCheck();
-		glGenBuffers(1,&vbo);
-		glBindBuffer(GL_ARRAY_BUFFER,vbo);
-		glBufferData(GL_ARRAY_BUFFER,sizeof(data),data,GL_STATIC_DRAW);
-		glEnableVertexAttribArray(attrib_vertex);
-		glEnableVertexAttribArray(attrib_tex);
-		glVertexAttribPointer(attrib_vertex,2,GL_FLOAT,GL_FALSE,0,0);
-		glVertexAttribPointer(attrib_tex,2,GL_FLOAT,GL_FALSE,0,(GLvoid*)(4*2*sizeof(GLfloat)));
-		glBindTexture(GL_TEXTURE_2D,texture);
-		glCheck();
-		glDrawArrays(GL_TRIANGLE_STRIP,0,4);
-		glDeleteBuffers(1,&vbo);
-		glDisableVertexAttribArray(attrib_vertex);
-		glDisableVertexAttribArray(attrib_tex);
-		glBindTexture(GL_TEXTURE_2D,0);
-		glBindBuffer(GL_ARRAY_BUFFER,0);
-		glUseProgram(0);
-		glCheck();
+		game.get_batch_2d().quad(glm::mat4(),glm::vec3(bl.x,bl.y,-1),glm::vec2(tr.x,tr.y),texture,
+			glm::vec2(0,1),glm::vec2(1,0),colour);
 	}
 	artwork_t* get_child(const std::string& id) { return this; }
 	void bounds(glm::vec3& min,glm::vec3& max) {
@@ -259,29 +290,73 @@ struct artwork_splash_t: public main_game_t::artwork_t, private main_t::texture_
 struct artwork_set_t: public main_game_t::artwork_t {
 	artwork_set_t(main_game_t& main,artwork_t* parent,const std::string& id_,class_t c,float sf,float sp,
 		const glm::vec3& a,float al,float attack_points,float health_points,float attack_range,float defend_range):
-		artwork_t(main,parent,id_,id_,c,sf,a,sp,al,attack_points,health_points,attack_range,defend_range) {}
+		artwork_t(main,parent,id_,id_,c,sf,a,sp,al,attack_points,health_points,attack_range,defend_range), prefetched(false) {}
 	~artwork_set_t() {
 		for(artworks_t::iterator i=artwork.begin(); i!=artwork.end(); i++)
 			delete *i;
 	}
 	typedef std::vector<artwork_t*> artworks_t;
 	artworks_t artwork;
+	// children load when first asked for, or when prefetch()ed; only those objects start with load up front
 	artwork_t* get_child(const std::string& id) {
 		artworks_t match; // no coffee-fueled reservoir sampling
 		for(artworks_t::iterator i=artwork.begin(); i!=artwork.end(); i++)
 			if((*i)->id == id)
 				match.push_back(*i);
-		if(match.size()) {
-			const size_t i = game.rand.rand(match.size());
-			return match.at(i);
+		artwork_t* child;
+		if(match.size())
+			child = match.at(game.rand.rand(match.size()));
+		else {
+			std::cout << "set " << this->id << " has no child " << id << std::endl;
+			child = artwork.front(); // default
 		}
-		std::cout << "set " << this->id << " has no child " << id << std::endl;
-		return artwork.front(); // default
+		child->prefetch();
+		return child;
+	}
+	void load_idle() { // every idle, as objects start with a random one; get_child() falls back to the front
+		bool any = false;
+		for(artworks_t::iterator i=artwork.begin(); i!=artwork.end(); i++)
+			if((*i)->id == "idle") {
+				(*i)->prefetch();
+				any = true;
+			}
+		if(!any)
+			artwork.front()->prefetch();
+	}
+	void prefetch() {
+		if(prefetched) return;
+		prefetched = true;
+		for(artworks_t::iterator i=artwork.begin(); i!=artwork.end(); i++)
+			(*i)->prefetch();
+	}
+	artwork_t* placeholder() { // an idle if one is ready, else anything that is
+		artwork_t* ready = NULL;
+		for(artworks_t::iterator i=artwork.begin(); i!=artwork.end(); i++)
+			if((*i)->is_ready()) {
+				if((*i)->id == "idle")
+					return *i;
+				if(!ready)
+					ready = *i;
+			}
+		return ready? ready: artwork.front();
+	}
+	artwork_t* front() {
+		artwork_t* front = artwork.front();
+		front->prefetch();
+		return front->is_ready()? front: placeholder();
 	}
 	void draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light0,const glm::vec4& colour) {
-		artwork.front()->draw(time,projection,modelview,light0,colour);
+		front()->draw(time,projection,modelview,light0,colour);
+	}
+	void queue(float time,const glm::mat4& modelview,const glm::vec4& colour) {
+		front()->queue(time,modelview,colour);
+	}
+	void pose_bounds(float time,glm::vec3& min,glm::vec3& max) {
+		front()->pose_bounds(time,min,max);
 	}
 	void bounds(glm::vec3& min, glm::vec3& max) {
+		min = glm::vec3(FLT_MAX,FLT_MAX,FLT_MAX);
+		max = glm::vec3(-FLT_MAX,-FLT_MAX,-FLT_MAX);
 		for(artworks_t::iterator i=artwork.begin(); i!=artwork.end(); i++) {
 			glm::vec3 mn, mx;
 			(*i)->bounds(mn,mx);
@@ -327,32 +402,88 @@ struct artwork_set_t: public main_game_t::artwork_t {
 	}
 	bool is_ready() {
 		for(artworks_t::iterator i=artwork.begin(); i!=artwork.end(); i++)
-			if(!(*i)->is_ready())
+			if((*i)->is_requested() && !(*i)->is_ready())
 				return false;
 		return true;
 	}
+	bool is_loaded() {
+		for(artworks_t::iterator i=artwork.begin(); i!=artwork.end(); i++)
+			if(!(*i)->is_loaded())
+				return false;
+		return true;
+	}
+	bool is_requested() {
+		for(artworks_t::iterator i=artwork.begin(); i!=artwork.end(); i++)
+			if((*i)->is_requested())
+				return true;
+		return false;
+	}
+private:
+	bool prefetched;
 };
 
 struct artwork_g3d_t: public main_game_t::artwork_t, private g3d_t::loaded_t {
 	artwork_g3d_t(main_game_t& main,artwork_t* parent,const std::string& id_,const std::string& p,class_t c,bool cy,float sf,float sp,
 		const glm::vec3& a,float al,float attack_points,float health_points,float attack_range,float defend_range):
 		artwork_t(main,parent,id_,p,c,sf,a,sp,al,attack_points,health_points,attack_range,defend_range),
-		path(p), cycles(cy), g3d(main,p,this), _ready(false) {}
+		path(p), cycles(cy),
+		_ready(false) {}
 	const std::string path;
 	const bool cycles;
-	g3d_t g3d;
+	std::auto_ptr<g3d_t> g3d; // made by prefetch()
+	void prefetch() {
+		if(g3d.get()) return;
+		std::cout << "loading G3D " << path << std::endl;
+		const g3d_t::residency_t residency = retain_for_batch()? g3d_t::RETAIN_CPU_COPY: g3d_t::DISCARD_CPU_COPY;
+		g3d.reset(new g3d_t(game,path,this,0,residency,vertex_format(),DECIMATE_G3D,LOD_G3D));
+	}
+	g3d_t* static_g3d() {
+		return (_ready && g3d->is_static())? g3d.get(): NULL;
+	}
+	void discard_cpu_copy() {
+		if(g3d.get()) // meshes still loading are made without
+			g3d->discard_cpu_copy();
+	}
+	bool is_requested() { return g3d.get(); }
+	static g3d_t::vertex_format_t vertex_format() {
+		if(FRAME_TEXTURES_G3D) return g3d_t::FRAME_TEXTURES;
+		return QUANTISE_G3D? g3d_t::QUANTISED_VERTICES: g3d_t::FLOAT_VERTICES;
+	}
 	void on_g3d_loaded(g3d_t& g3d,bool ok,intptr_t data) {
 		if(!ok) data_error("failed to load " << path);
 		_ready = true;
 		artwork_t::on_ready(this);
 	}
-	void draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light0,const glm::vec4& colour) {
+	float anim_time(float time) const {
 		const float anim_len = (animation_length>0?animation_length:2);
-		const float t = fmod(time/anim_len,1);
-		g3d.draw(t,projection,modelview,light0,cycles,colour);
+		return fmod(time/anim_len,1);
+	}
+	void draw(float time,const glm::mat4& projection,const glm::mat4& modelview,const glm::vec3& light0,const glm::vec4& colour) {
+		if(_ready)
+			g3d->draw(anim_time(time),projection,modelview,light0,cycles,colour);
+	}
+	void draw_instances(const g3d_t::instances_t& instances,const glm::mat4& projection,const glm::vec3& light0) {
+		if(!_ready) return;
+		g3d_t::instances_t animated(instances);
+		for(g3d_t::instances_t::iterator i=animated.begin(); i!=animated.end(); i++)
+			i->time = anim_time(i->time);
+		g3d->draw(animated,projection,light0,cycles);
 	}
 	artwork_t* get_child(const std::string& id) { return this; }
-	void bounds(glm::vec3& min,glm::vec3& max) { return g3d.bounds(min,max); }
+	void bounds(glm::vec3& min,glm::vec3& max) {
+		if(_ready)
+			g3d->bounds(min,max);
+		else {
+			min = glm::vec3(FLT_MAX,FLT_MAX,FLT_MAX);
+			max = glm::vec3(-FLT_MAX,-FLT_MAX,-FLT_MAX);
+		}
+	}
+	void pose_bounds(float time,glm::vec3& min,glm::vec3& max) {
+		if(_ready)
+			g3d->bounds(anim_time(time),cycles,min,max);
+		else
+			bounds(min,max);
+	}
 	void save(std::stringstream& xml) {
 		std::string indent = "\t\t";
 		for(const artwork_t* p=parent; p; p = p->parent)
@@ -422,8 +553,10 @@ main_game_t::artwork_t* main_game_t::load_asset(xml_walker_t& xml,artwork_t* par
 	if(type == "g3d") {
 		const std::string path = xml.value_string("path");
 		const bool cycles = xml.has_key("cycles")? xml.value_bool("cycles"): true;
-		std::cout << "loading G3D " << path << std::endl;
-		return new artwork_g3d_t(*this,parent,id,path,cls,cycles,scaler,speed,anchor,animation_length,attack_points,health_points,attack_range,defend_range);
+		artwork_g3d_t* g3d = new artwork_g3d_t(*this,parent,id,path,cls,cycles,scaler,speed,anchor,animation_length,attack_points,health_points,attack_range,defend_range);
+		if(!parent) // sets decide which of theirs to load
+			g3d->prefetch();
+		return g3d;
 	} else if(type == "splash") {
 		const std::string path = xml.value_string("path");
 		std::cout << "loading splash " << path << std::endl;
@@ -432,6 +565,8 @@ main_game_t::artwork_t* main_game_t::load_asset(xml_walker_t& xml,artwork_t* par
 		artwork_set_t* set = new artwork_set_t(*this,parent,id,cls,scaler,speed,anchor,animation_length,attack_points,health_points,attack_range,defend_range);
 		for(int i=0; xml.get_child("asset",i); i++, xml.up())
 			set->artwork.push_back(load_asset(xml,set));
+		if(!parent)
+			set->load_idle();
 		return set;
 	} else
 		data_error("unsupported artwork type "<<type);
@@ -440,7 +575,7 @@ main_game_t::artwork_t* main_game_t::load_asset(xml_walker_t& xml,artwork_t* par
 struct main_game_t::object_t {
 	object_t(artwork_t& a,const glm::vec2& p):
 		artwork(a), pos(p), state(WALKING), attacking(false), defending(false), waiting(true),
-		has_pickaxe(false), health_points(a.health_points), bury(false) {
+		has_pickaxe(false), health_points(a.health_points), bury(false), batched(false), tiled(false) {
 			dir[WALKING] = dir[JUMPING] = EDITOR;
 			action[WALKING] = action[JUMPING] = "idle";
 			active_artwork[WALKING] = active_artwork[JUMPING] = artwork.get_child("idle");
@@ -477,7 +612,7 @@ struct main_game_t::object_t {
 		this->state = state;
 		animation_start[state] = artwork.game.now_secs();
 	}
-	void draw(float time,const glm::mat4& projection,const glm::vec3& light0,const glm::vec4& colour = glm::vec4(1,1,1,1)) {
+	void queue(float time,const glm::vec4& colour = glm::vec4(1,1,1,1)) {
 		if(bury) return;
 		time -= animation_start[state];
 		if(time > active_artwork[state]->effective_animation_length()) { // time to change it then
@@ -492,9 +627,14 @@ struct main_game_t::object_t {
 				animation_start[state] = artwork.game.now_secs();
 			}
 		}
-		active_artwork[state]->draw(time,projection,tx(),light0,colour);		
+		shown()->queue(time,tx(),colour);
+	}
+	// the action's artwork or, until that has loaded, a stand-in from the same set
+	artwork_t* shown() const {
+		artwork_t* active = active_artwork[state];
+		return active->is_ready()? active: artwork.placeholder();
 	}
-	glm::mat4 tx() {
+	glm::mat4 tx() const {
 		glm::mat4 tx(glm::translate(glm::vec3(pos.x-artwork.anchor.x,pos.y-artwork.anchor.y,-artwork.cls))*artwork.tx);
 		if(dir[WALKING] == LEFT) // WALKING defines facing, even if completing a jump in another direction
 			tx *= glm::rotate(270.0f,glm::vec3(0,1,0));
@@ -502,12 +642,27 @@ struct main_game_t::object_t {
 			tx *= glm::rotate(90.0f,glm::vec3(0,1,0));
 		return tx;
 	}
-	bool is_visible(const rect_t& screen) const {
-		return screen.intersects(effective_rect());
+	bool is_visible(const rect_t& screen,double now) const {
+		return screen.intersects(pose_rect(now));
+	}
+	// where the pose drawn at now actually lands; effective_rect() covers the whole animation,
+	// unturned, and stays what gameplay is tuned to
+	rect_t pose_rect(double now) const {
+		glm::vec3 min, max;
+		shown()->pose_bounds(now-animation_start[state],min,max);
+		if(min.x > max.x) return rect_t(glm::vec2(0,0),glm::vec2(0,0)); // nothing loaded yet
+		const glm::mat4 tx(this->tx());
+		glm::vec2 bl(FLT_MAX,FLT_MAX), tr(-FLT_MAX,-FLT_MAX);
+		for(int corner=0; corner<8; corner++) {
+			const glm::vec4 p = tx*glm::vec4((corner&1)?max.x:min.x,(corner&2)?max.y:min.y,(corner&4)?max.z:min.z,1);
+			bl = glm::min(bl,glm::vec2(p.x,p.y));
+			tr = glm::max(tr,glm::vec2(p.x,p.y));
+		}
+		return rect_t(bl,tr);
 	}
 	rect_t effective_rect() const {
 		const glm::vec2 anchor(artwork.anchor.x,pos.y-artwork.anchor.y);
-		rect_t rect = active_artwork[state]->rect();
+		rect_t rect = shown()->rect();
 		return rect_t(rect.bl+pos,rect.tr+pos);
 	}
 	rect_t attack_rect() const {
@@ -518,38 +673,25 @@ struct main_game_t::object_t {
 	}
 	bool is_dead() const { return (health_points <= 0) && artwork.health_points; }
 	bool bury;
+	bool batched; // drawn by main_game_t::static_batch
+	bool tiled; // drawn by main_game_t::tile_cache
 };
 
+const float rect_t::Z = -2;
+
 void rect_t::draw(main_t& main,const glm::mat4& mvp,glm::vec4 colour) {
-	const GLfloat data[4*2] = {
-		bl.x,bl.y,
-		tr.x,bl.y,
-		tr.x,tr.y,
-		bl.x,tr.y};
-	GLuint program = main.get_shared_program("path_t"),
-		uniform_mvp_matrix = main.get_uniform_loc(program,"MVP_MATRIX",GL_FLOAT_MAT4),
-		uniform_colour = main.get_uniform_loc(program,"COLOUR",GL_FLOAT_VEC4),
-		attrib_vertex = main.get_attribute_loc(program,"VERTEX",GL_FLOAT_VEC2),
-		vbo;
-	glUseProgram(program);
-	glUniform4fv(uniform_colour,1,glm::value_ptr(colour));
-	glUniformMatrix4fv(uniform_mvp_matrix,1,false,glm::value_ptr(mvp));
-	glEnableVertexAttribArray(attrib_vertex);
-	glCheck();
-	glGenBuffers(1,&vbo);
-	glBindBuffer(GL_ARRAY_BUFFER,vbo);
-	glBufferData(GL_ARRAY_BUFFER,sizeof(data),data,GL_STATIC_DRAW);
-	glLineWidth(2.);
-	glVertexAttribPointer(attrib_vertex,2,GL_FLOAT,GL_FALSE,0,0);
-	glDrawArrays(GL_LINE_LOOP,0,4);
-	glDeleteBuffers(1,&vbo);
-	glDisableVertexAttribArray(attrib_vertex);
-	glBindBuffer(GL_ARRAY_BUFFER,0);
-	glUseProgram(0);
-	glCheck();
+	batch_2d_t& batch = main.get_batch_2d();
+	const glm::vec3 corners[4] = {glm::vec3(bl,Z), glm::vec3(tr.x,bl.y,Z), glm::vec3(tr,Z), glm::vec3(bl.x,tr.y,Z)};
+	for(int i=0; i<4; i++)
+		batch.line(mvp,corners[i],corners[(i+1)%4],colour);
+}
+
+void rect_t::fill(main_t& main,const glm::mat4& mvp,glm::vec4 colour) {
+	main.get_batch_2d().quad(mvp,glm::vec3(bl,Z),tr,colour);
 }
 
 void main_game_t::init() {
+	load_started = high_precision_time();
 	create_shaders(*this);
 	glClearColor(0,0,0,1);
 	read_file("data/game.xml",this,LOAD_GAME_XML);
@@ -571,6 +713,24 @@ void main_game_t::on_io(const std::string& name,bool ok,const std::string& bytes
 		xml.check("game");
 		if(xml.has_key("debug_level"))
 			DEBUG_LEVEL = xml.value_int("debug_level");
+		if(xml.has_key("quantise_g3d"))
+			QUANTISE_G3D = xml.value_bool("quantise_g3d");
+		if(xml.has_key("frame_textures_g3d"))
+			FRAME_TEXTURES_G3D = xml.value_bool("frame_textures_g3d");
+		if(xml.has_key("decimate_g3d"))
+			DECIMATE_G3D = xml.value_float("decimate_g3d");
+		if(xml.has_key("lod_g3d"))
+			LOD_G3D = xml.value_float("lod_g3d");
+		if(xml.has_key("cooked_g3d"))
+			g3d_t::use_cooked = xml.value_bool("cooked_g3d");
+		if(xml.has_key("vertex_arrays_g3d"))
+			g3d_t::use_vertex_arrays = xml.value_bool("vertex_arrays_g3d");
+		if(xml.has_key("instancing_g3d"))
+			g3d_t::use_instancing = xml.value_bool("instancing_g3d");
+		if(xml.has_key("static_batch"))
+			STATIC_BATCH = xml.value_bool("static_batch");
+		if(xml.has_key("tile_cache"))
+			TILE_CACHE = xml.value_bool("tile_cache");
 		xml.get_child("artwork");
 		for(int i=0; xml.get_child("asset",i); i++, xml.up()) {
 			artwork_t* a = load_asset(xml);
@@ -587,8 +747,22 @@ void main_game_t::on_io(const std::string& name,bool ok,const std::string& bytes
 }
 
 void main_game_t::on_ready(artwork_t*) {
-	if(is_ready()) {
-		std::cout << "artwork all loaded" << std::endl;
+	if((mode == MODE_LOAD) && is_ready()) { // later arrivals are set children loading on demand
+		std::cout << "artwork to start with loaded in " << (high_precision_time()-load_started)/1000000 << "ms with " <<
+			get_jobs().worker_count() << " workers" << std::endl;
+		const g3d_t::stats_t& g3d_stats = g3d_t::stats();
+		std::cout << "G3D memory: " << g3d_stats.gpu_bytes << " bytes in GL buffers, " <<
+			g3d_stats.cpu_bytes << " retained on the heap, " << g3d_stats.discarded_bytes << " freed after upload, " <<
+			g3d_stats.decimated_bytes << " saved by decimating frames, " << g3d_stats.frame_texture_meshes << " meshes animated from frame textures, " <<
+			g3d_stats.lod_bytes << " in levels of detail" << std::endl;
+		std::cout << "G3D buffers: " << (get_buffer_arena(GL_ARRAY_BUFFER).buffer_count()+get_buffer_arena(GL_ELEMENT_ARRAY_BUFFER).buffer_count()) <<
+			" buffer objects, " << g3d_stats.unpooled_buffers << " if every frame had its own" << std::endl;
+		const asset_registry_t::stats_t& shared = get_asset_registry().stats();
+		std::cout << "shared assets: " << shared.buffer_hits << " of " << shared.buffer_requests << " buffers were duplicates, " <<
+			shared.buffer_bytes_stored << " of " << shared.buffer_bytes_requested << " bytes stored; " <<
+			shared.texture_hits << " of " << shared.texture_requests << " textures were duplicates; " <<
+			shared.collisions << " hash collisions" << std::endl;
+		g3d_t::reset_draw_stats();
 		mode = MODE_PLACE_OBJECT;
 		xml_walker_t xml(game_xml.walker());
 		xml.check("game").get_child("level");
@@ -638,7 +812,14 @@ bool main_game_t::tick() {
 	static double last_tick = now_secs();
 	const double now = now_secs(), since_last = now-last_tick;
 	if(mode == MODE_SPLASH) {
+		static bool first = true;
+		if(first) {
+			std::cout << "first playable frame after " << (high_precision_time()-load_started)/1000000 << "ms" << std::endl;
+			first = false;
+		}
 		artwork["SPLASH"]->draw(rect_t(glm::vec2(-1,-1),glm::vec2(1,1)),glm::mat4(),glm::vec4(1,1,1,1));
+		// the play screen will be centred on the player
+		prefetch(rect_t(player->pos-glm::vec2(width/2,height/2),player->pos+glm::vec2(width/2,height/2)));
 		return true;
 	} else if(mode == MODE_PLAY) {
 		if(exited) {
@@ -662,36 +843,68 @@ bool main_game_t::tick() {
 		screen.bl.x,screen.tr.x, // 0,0 is screen centre
 		screen.bl.y,screen.tr.y, // y increases upwards
 		1,300));
-	const glm::vec3 light0(10,10,10);
+	const glm::vec3& light0 = LIGHT_0;
+	prefetch(screen);
+	if(show_overdraw) { // count every fragment that passes the depth test
+		glClear(GL_STENCIL_BUFFER_BIT);
+		glEnable(GL_STENCIL_TEST);
+		glStencilFunc(GL_ALWAYS,0,0xff);
+		glStencilOp(GL_KEEP,GL_KEEP,GL_INCR);
+	}
 	// show all the objects
+	if(TILE_CACHE && !tile_cache.get() && tile_cache_t::supported())
+		tile_cache.reset(new tile_cache_t(*this,*this));
+	if(tile_cache.get())
+		for(objects_t::iterator i=objects.begin(); i!=objects.end(); i++) {
+			const bool tiled = is_static_back(**i);
+			if(tiled != (*i)->tiled) { // arrived since its tiles were painted, or they have it in a pose it has left
+				const rect_t rect((*i)->pose_rect(now));
+				tile_cache->invalidate(rect.bl,rect.tr);
+			}
+			(*i)->tiled = tiled;
+		}
 	objects_t reap;
 	for(objects_t::iterator i=objects.begin(); i!=objects.end(); i++) {
-		if((*i)->is_visible(screen))
-			(*i)->draw(now,projection,light0);
-		if(DEBUG_LEVEL) {
+		if(!(*i)->batched && !(*i)->tiled && (*i)->is_visible(screen,now))
+			(*i)->queue(now);
+		if((mode == MODE_PLAY) && (*i)->bury && *i!=player && *i!=balrog)
+			reap.push_back(*i);
+	}
+	// show active model on top for editing
+	if((mode == MODE_PLACE_OBJECT) && active_model && mouse_down)
+		active_model->queue(now,
+			glm::translate(glm::vec3(screen_centre.x+mouse_x-width/2,screen_centre.y-mouse_y+height/2,-50))*
+				active_model->tx,
+			glm::vec4(1,.6,.6,.6));
+	draw_queued(projection,light0);
+	if(show_overdraw) {
+		glDisable(GL_DEPTH_TEST);
+		glStencilOp(GL_KEEP,GL_KEEP,GL_KEEP);
+		// black for none, then blue, green, yellow and red for 5 or more
+		static const glm::vec4 heat[] = {
+			glm::vec4(0,0,0,1), glm::vec4(0,0,1,1), glm::vec4(0,1,0,1), glm::vec4(1,1,0,1), glm::vec4(1,.5,0,1), glm::vec4(1,0,0,1)};
+		const int levels = sizeof(heat)/sizeof(*heat);
+		for(int i=0; i<levels; i++) {
+			glStencilFunc((i < levels-1)? GL_EQUAL: GL_LEQUAL,i,0xff);
+			screen.fill(*this,projection,heat[i]);
+			get_batch_2d().flush(); // under this stencil test
+		}
+		glDisable(GL_STENCIL_TEST);
+		glEnable(GL_DEPTH_TEST);
+	}
+	if(DEBUG_LEVEL)
+		for(objects_t::iterator i=objects.begin(); i!=objects.end(); i++) {
 			if((*i)->defending)
 				(*i)->defend_rect().draw(*this,projection,glm::vec4(1,1,1,.5));
 			if((*i)->attacking)
 				(*i)->attack_rect().draw(*this,projection,glm::vec4(1,0,0,.5));
 		}
-		if((mode == MODE_PLAY) && (*i)->bury && *i!=player && *i!=balrog)
-			reap.push_back(*i);
-	}
 	for(objects_t::iterator i=reap.begin(); i!=reap.end(); i++) {
 		objects.erase(std::find(objects.begin(),objects.end(),*i));
 		delete *i;
 	}
-	if(mode != MODE_PLAY) {
-		// show active model on top for editing
-		if((mode == MODE_PLACE_OBJECT) && active_model && mouse_down) {
-			active_model->draw(now,projection,
-				glm::translate(glm::vec3(screen_centre.x+mouse_x-width/2,screen_centre.y-mouse_y+height/2,-50))*
-					active_model->tx,
-				light0,glm::vec4(1,.6,.6,.6));
-		}
-		if((mode == MODE_HOT) && draw_hot)
-			new_hot.draw(*this,projection,glm::vec4(1,1,0,1));
-	}
+	if((mode == MODE_HOT) && draw_hot)
+		new_hot.draw(*this,projection,glm::vec4(1,1,0,1));
 	if(mode != MODE_PLAY || DEBUG_LEVEL) {
 		for(hots_t::iterator i=hots.begin(); i!=hots.end(); i++)
 			i->draw(*this,projection,glm::vec4(0,1,0,1));
@@ -701,11 +914,87 @@ bool main_game_t::tick() {
 		if(ceiling.get())
 			ceiling->draw(projection,glm::vec4(1,1,0,1));
 	}
+	if(DEBUG_LEVEL) {
+		static double last_report = now;
+		if(now-last_report >= 10) {
+			const g3d_t::stats_t& g3d_stats = g3d_t::stats();
+			std::cout << "G3D draws: " << g3d_stats.mesh_draws << " meshes, " << g3d_stats.buffer_binds << " buffer binds, " <<
+				g3d_stats.unpooled_buffer_binds << " if every frame had its own buffer; " << g3d_stats.lod_draws <<
+				" at a coarser level of detail, " << g3d_stats.lod_triangles_saved << " triangles saved; " <<
+				(g3d_stats.object_draws? g3d_stats.draw_ns/g3d_stats.object_draws/1000.: 0.) << "us CPU per model drawn, " <<
+				((g3d_t::use_vertex_arrays && gl_state_t::vertex_arrays_supported())? "with": "without") << " vertex array objects; " <<
+				g3d_stats.matrix_inversions << " normal matrices and " << g3d_stats.uniform_uploads << " uniform uploads, " <<
+				g3d_stats.mesh_draws << " and " << g3d_stats.unshared_uniform_uploads << " if set for each mesh; " <<
+				g3d_stats.instanced_draws << " instanced draws" << std::endl;
+			g3d_t::reset_draw_stats();
+			const gl_state_t::stats_t& gl_stats = get_gl_state().frame_stats();
+			std::cout << "GL last frame: " << gl_stats.draw_calls << " draws, " << gl_stats.program_switches << " program switches, " <<
+				gl_stats.buffer_binds << " buffer binds, " << gl_stats.texture_binds << " texture binds, " <<
+				gl_stats.attrib_toggles << " attrib toggles, " << gl_stats.vertex_array_binds << " vertex array binds, " <<
+				gl_stats.instances << " instances drawn instanced; " << gl_stats.skipped << " redundant calls skipped; " <<
+				gl_stats.gl_errors << " GL errors" << std::endl;
+			if(static_batch.get())
+				std::cout << "static batch last frame: " << static_batch->stats().draws << " draws for " <<
+					static_batch->stats().models << " background models" << std::endl;
+			if(tile_cache.get())
+				std::cout << "tile cache last frame: " << tile_cache->stats().draws << " tiles drawn, " <<
+					tile_cache->stats().paints << " painted, " << tile_cache->stats().tiles << " kept" << std::endl;
+			const batch_2d_t::stats_t& batch_stats = get_batch_2d().stats();
+			std::cout << "2D batch: " << batch_stats.draws << " draws of " << batch_stats.vertices << " vertices in " <<
+				batch_stats.flushes << " flushes; " << batch_stats.buffer_bytes << " byte buffer" << std::endl;
+			get_batch_2d().reset_stats();
+			last_report = now;
+		}
+	}
 	// done
 	last_tick = now;
 	return true; // return false to exit program
 }
 
+void main_game_t::queue_draw(artwork_t* artwork,float time,const glm::mat4& modelview,const glm::vec4& colour) {
+	draw_queue_t::iterator q = draw_queue.begin();
+	while(q != draw_queue.end() && q->first != artwork) // there are few artworks on screen
+		q++;
+	if(q == draw_queue.end())
+		q = draw_queue.insert(q,std::make_pair(artwork,g3d_t::instances_t()));
+	q->second.push_back(g3d_t::instance_t(time,modelview,colour));
+}
+
+bool main_game_t::nearest_first(const draw_queue_t::value_type& a,const draw_queue_t::value_type& b) {
+	return a.first->cls < b.first->cls; // objects stand at z = -cls
+}
+
+bool main_game_t::farthest_first(const draw_queue_t::value_type& a,const draw_queue_t::value_type& b) {
+	return a.second.front().modelview[3][2] < b.second.front().modelview[3][2];
+}
+
+void main_game_t::draw_queued(const glm::mat4& projection,const glm::vec3& light0) {
+	// each translucent instance is drawn alone, as they are sorted by their own depth
+	draw_queue_t translucent;
+	for(draw_queue_t::iterator q=draw_queue.begin(); q!=draw_queue.end(); q++) {
+		g3d_t::instances_t::iterator i = std::stable_partition(q->second.begin(),q->second.end(),is_opaque);
+		for(g3d_t::instances_t::iterator t=i; t!=q->second.end(); t++)
+			translucent.push_back(std::make_pair(q->first,g3d_t::instances_t(1,*t)));
+		q->second.erase(i,q->second.end());
+	}
+	// opaque, nearest first, so what they hide fails the depth test instead of being shaded
+	std::stable_sort(draw_queue.begin(),draw_queue.end(),nearest_first);
+	glDisable(GL_BLEND);
+	for(draw_queue_t::iterator q=draw_queue.begin(); q!=draw_queue.end(); q++)
+		if(q->second.size())
+			q->first->draw_instances(q->second,projection,light0);
+	if(!tile_cache.get() && static_batch.get())
+		static_batch->draw(projection,light0,screen.bl,screen.tr);
+	glEnable(GL_BLEND);
+	if(tile_cache.get()) // tiles are transparent where there is no background
+		tile_cache->draw(projection,screen.bl,screen.tr,-artwork_t::CLS_BACK);
+	// translucent, farthest first, so each blends over all that is behind it
+	std::stable_sort(translucent.begin(),translucent.end(),farthest_first);
+	for(draw_queue_t::iterator q=translucent.begin(); q!=translucent.end(); q++)
+		q->first->draw_instances(q->second,projection,light0);
+	draw_queue.clear();
+}
+
 void main_game_t::play_tick(float step) {
 	if(player->is_dead()) return;
 	// move main player
@@ -794,7 +1083,7 @@ void main_game_t::play_tick(float step) {
 			object_t& monster = **i;
 			if(monster.is_dead()) continue;
 			if(monster.waiting) {
-				if(monster.is_visible(screen)) {
+				if(screen.intersects(monster.effective_rect())) { // the whole animation, as gameplay is tuned to
 					monster.waiting = false;
 					std::cout << "monster " << monster.artwork.id << " activated" << std::endl;
 				}
@@ -846,6 +1135,13 @@ void main_game_t::play_tick(float step) {
 	}
 }
 
+void main_game_t::prefetch(const rect_t& area) {
+	const rect_t near(area.grow(glm::vec2(PREFETCH_MARGIN,PREFETCH_MARGIN)));
+	for(objects_t::iterator o=objects.begin(); o!=objects.end(); o++)
+		if(near.intersects((*o)->effective_rect()))
+			(*o)->artwork.prefetch();
+}
+
 void main_game_t::save() {
 	if((mode == MODE_LOAD) || (mode == MODE_PLAY)) {
 		std::cout << "cannot save in this mode" << std::endl;
@@ -853,7 +1149,26 @@ void main_game_t::save() {
 	}
 	std::cout << "saving..." << std::endl;
 	std::stringstream xml(std::ios_base::out|std::ios_base::ate);
-	xml << "<game>\n\t<artwork>\n";
+	xml << "<game";
+	if(QUANTISE_G3D)
+		xml << " quantise_g3d=\"true\"";
+	if(FRAME_TEXTURES_G3D)
+		xml << " frame_textures_g3d=\"true\"";
+	if(DECIMATE_G3D > 0)
+		xml << " decimate_g3d=\"" << DECIMATE_G3D << '"';
+	if(LOD_G3D > 0)
+		xml << " lod_g3d=\"" << LOD_G3D << '"';
+	if(!g3d_t::use_cooked)
+		xml << " cooked_g3d=\"false\"";
+	if(g3d_t::use_vertex_arrays)
+		xml << " vertex_arrays_g3d=\"true\"";
+	if(!g3d_t::use_instancing)
+		xml << " instancing_g3d=\"false\"";
+	if(!STATIC_BATCH)
+		xml << " static_batch=\"false\"";
+	if(TILE_CACHE)
+		xml << " tile_cache=\"true\"";
+	xml << ">\n\t<artwork>\n";
 	for(artworks_t::iterator a=artwork.begin(); a!=artwork.end(); a++)
 		a->second->save(xml);
 	xml << "\t</artwork>\n\t<level>\n";
@@ -912,14 +1227,105 @@ void main_game_t::play() {
 	mode = MODE_SPLASH;
 	pan_rate = glm::vec2(0,0);
 	glClearColor(0,0,0,1);
+	if(STATIC_BATCH) // so the background is there to batch by the time the splash screen is dismissed
+		for(objects_t::iterator o=objects.begin(); o!=objects.end(); o++)
+			if((*o)->artwork.cls == artwork_t::CLS_BACK)
+				(*o)->artwork.prefetch();
 	std::cout << "Playing game!" << std::endl;
 }
 
+bool main_game_t::is_static_back(object_t& object) const {
+	if(object.artwork.cls != artwork_t::CLS_BACK || object.shown() != &object.artwork || !object.artwork.static_g3d())
+		return false;
+	for(hots_t::const_iterator h=hots.begin(); h!=hots.end(); h++)
+		if(h->type == hot_t::SPECIAL && h->special == &object)
+			return false;
+	return true;
+}
+
+void main_game_t::paint_tile(const glm::vec2& min,const glm::vec2& max) {
+	const rect_t tile(min,max);
+	const glm::mat4 projection(glm::ortho<float>(min.x,max.x,min.y,max.y,1,300)); // as tick()'s
+	if(static_batch.get())
+		static_batch->draw(projection,LIGHT_0,min,max);
+	const double now = now_secs();
+	for(objects_t::iterator i=objects.begin(); i!=objects.end(); i++)
+		if((*i)->tiled && !(*i)->batched && tile.intersects((*i)->pose_rect(now)))
+			(*i)->artwork.draw(0,projection,(*i)->tx(),LIGHT_0);
+}
+
+void main_game_t::invalidate_tiles(object_t& object) {
+	if(tile_cache.get() && object.tiled) {
+		const rect_t rect(object.pose_rect(now_secs()));
+		tile_cache->invalidate(rect.bl,rect.tr);
+	}
+}
+
+void main_game_t::start_play() {
+	mode = MODE_PLAY;
+	if(!STATIC_BATCH) return;
+	// the background never moves in play; the editor, which moves it, is never returned to
+	const uint64_t started = high_precision_time();
+	static_batch.reset(new g3d_batch_t(*this,STATIC_BATCH_CHUNK));
+	for(objects_t::iterator o=objects.begin(); o!=objects.end(); o++) {
+		object_t& object = **o;
+		if(!is_static_back(object)) // not yet loaded is drawn as usual
+			continue;
+		g3d_t& g3d = *object.artwork.static_g3d();
+		if(!g3d_batch_t::can_batch(g3d))
+			continue;
+		static_batch->add(g3d,object.tx());
+		object.batched = true;
+	}
+	static_batch->build();
+	// the batch has its own copy, so the models drop theirs, as do those it didn't take, animated or loading;
+	// the batched drop their buffers too, unless an object the batch didn't take still draws them
+	const size_t cpu_bytes = g3d_t::stats().cpu_bytes, gpu_bytes = g3d_t::stats().gpu_bytes;
+	std::set<g3d_t*> batched, drawn;
+	for(objects_t::iterator o=objects.begin(); o!=objects.end(); o++)
+		if(g3d_t* g3d = (*o)->artwork.static_g3d())
+			((*o)->batched? batched: drawn).insert(g3d);
+	for(artworks_t::iterator a=artwork.begin(); a!=artwork.end(); a++)
+		a->second->discard_cpu_copy();
+	for(std::set<g3d_t*>::iterator g=batched.begin(); g!=batched.end(); g++)
+		if(!drawn.count(*g))
+			(*g)->release_gl();
+	const g3d_batch_t::stats_t& stats = static_batch->stats();
+	std::cout << "batched " << stats.models << " background models, " << stats.meshes << " meshes, into " <<
+		stats.groups << " draws over " << stats.chunks << " chunks, " << stats.bytes << " bytes, in " <<
+		(high_precision_time()-started)/1000 << "us; freed " << (cpu_bytes-g3d_t::stats().cpu_bytes) << " bytes of model arrays and " <<
+		(gpu_bytes-g3d_t::stats().gpu_bytes) << " of model buffers" << std::endl;
+}
+
+bool main_game_t::toggle_debug_view(short code) {
+	switch(code) {
+	case 'l': case 'L':
+		g3d_t::lod_debug_colours = !g3d_t::lod_debug_colours;
+		std::cout << "LOD COLOURS " << (g3d_t::lod_debug_colours?"ON":"OFF") << std::endl;
+		return true;
+	case 'd': case 'D': {
+		GLint stencil_bits = 0;
+		glGetIntegerv(GL_STENCIL_BITS,&stencil_bits);
+		if(!stencil_bits) {
+			std::cout << "OVERDRAW needs a stencil buffer" << std::endl;
+			return true;
+		}
+		show_overdraw = !show_overdraw;
+		std::cout << "OVERDRAW " << (show_overdraw?"ON":"OFF") << std::endl;
+		return true;
+	}
+	default: return false;
+	}
+}
+
 bool main_game_t::on_key_down(short code) {
 	if(mode == MODE_SPLASH) {
-		mode = MODE_PLAY;
+		start_play();
 		return true;
-	} else if(mode == MODE_PLAY) {
+	}
+	if((mode != MODE_PLAY || DEBUG_LEVEL) && toggle_debug_view(code)) // the editor's are always on
+		return true;
+	if(mode == MODE_PLAY) {
 		if(player->is_dead()) return true;
 		switch(code) {
 		case KEY_UP:
@@ -1048,6 +1454,7 @@ bool main_game_t::on_key_up(short code) {
 			if(code == KEY_BACKSPACE) {
 				if(active_object) {
 					std::cout << "DELETING OBJECT " << active_object->artwork.id << std::endl;
+					invalidate_tiles(*active_object);
 					objects.erase(std::find(objects.begin(),objects.end(),active_object));
 					delete active_object;
 					active_object = NULL;
@@ -1091,29 +1498,23 @@ bool main_game_t::on_mouse_down(int x,int y,mouse_button_t button) {
 	const int mapped_x = screen_centre.x+mouse_x-width/2, mapped_y = screen_centre.y-mouse_y+height/2;
 	switch(mode) {
 	case MODE_SPLASH:
-		mode = MODE_PLAY;
+		start_play();
 		return true;
 	case MODE_EDIT_OBJECT:
 		if(button == MOUSE_DRAG) {
 			if(active_object) {
 				const glm::vec2 pos(mapped_x,mapped_y),
 					ofs(pos-active_object_anchor);
+				invalidate_tiles(*active_object);
 				active_object->pos += ofs;
+				invalidate_tiles(*active_object);
 				active_object_anchor = pos;
 			}
 		} else {
 			active_object = NULL;
 			const glm::vec2 pos(mapped_x,mapped_y);
 			for(objects_t::iterator o=objects.begin(); o!=objects.end(); o++) {
-				glm::vec3 bl1, tr1;
-				(*o)->artwork.bounds(bl1,tr1);
-				const glm::mat4 tx = (*o)->tx();
-				const glm::vec4 bl = tx * glm::vec4(bl1,1);
-				const glm::vec4 tr = tx * glm::vec4(tr1,1);
-				if((pos.x>=bl.x) &&
-					(pos.y>=bl.y) &&
-					(pos.x<tr.x) &&
-					(pos.y<tr.y)) {
+				if((*o)->pose_rect(now_secs()).contains(pos)) {
 					active_object = *o;
 					active_object_anchor = pos;
 					break;
@@ -2,6 +2,7 @@
 
 #include "paths.hpp"
 #include "barebones/xml.hpp"
+#include "barebones/batch_2d.hpp"
 #include "external/ogl-math/glm/gtx/closest_point.hpp"
 
 static float distance(const glm::vec2& a,const glm::vec2& b) {
@@ -11,14 +12,7 @@ static float distance(const glm::vec2& a,const glm::vec2& b) {
 
 float path_t::link_t::length() const { return ::distance(a->pos,b->pos); }
 
-path_t::path_t(main_t& m): main(m), program(m.get_shared_program("path_t")),
-	dirty(true), id_seq(0), active_node(false) {
-	graphics_assert(program);
-	glGenBuffers(sizeof(vbo)/sizeof(*vbo),vbo);
-	uniform_mvp_matrix = main.get_uniform_loc(program,"MVP_MATRIX",GL_FLOAT_MAT4);
-	uniform_colour = main.get_uniform_loc(program,"COLOUR",GL_FLOAT_VEC4);
-	attrib_vertex = main.get_attribute_loc(program,"VERTEX",GL_FLOAT_VEC2);
-}
+path_t::path_t(main_t& m): main(m), id_seq(0), active_node(false) {}
 
 bool path_t::y_at(const glm::vec2& p,float& y,bool down) const {
 	assert(down);
@@ -90,70 +84,15 @@ void path_t::save(std::stringstream& xml) const {
 }
 
 void path_t::draw(const glm::mat4& projection,const glm::vec4& colour) {
-	glUseProgram(program);
-	glUniform4fv(uniform_colour,1,glm::value_ptr(const_cast<glm::vec4&>(colour)));
-	glUniformMatrix4fv(uniform_mvp_matrix,1,false,glm::value_ptr(projection));
-	glEnableVertexAttribArray(attrib_vertex);
-	glCheck();
-	if(links.size()) {
-		glBindBuffer(GL_ARRAY_BUFFER,vbo[0]);
-		if(dirty) {
-			const size_t data_size = links.size()*4;
-			GLfloat* const data = new GLfloat[data_size], *p = data;
-			for(links_t::const_iterator l=links.begin(); l!=links.end(); l++) {
-				*p++ = (*l)->a->pos.x;
-				*p++ = (*l)->a->pos.y;
-				*p++ = (*l)->b->pos.x;
-				*p++ = (*l)->b->pos.y;
-			}
-			glBufferData(GL_ARRAY_BUFFER,data_size*sizeof(GLfloat),data,GL_STATIC_DRAW);
-			glCheck();
-			delete[] data;
-		}
-		glLineWidth(2.);
-		glVertexAttribPointer(attrib_vertex,2,GL_FLOAT,GL_FALSE,0,0);
-		glDrawArrays(GL_LINES,0,links.size()*2);
-		glBindBuffer(GL_ARRAY_BUFFER,0);
-		glCheck();
-	}
-	if(active_node) {
-		glBindBuffer(GL_ARRAY_BUFFER,vbo[2]);
-		GLfloat data[2] = {active_node->pos.x,active_node->pos.y};
-		glBufferData(GL_ARRAY_BUFFER,sizeof(data),data,GL_STATIC_DRAW);
-#ifndef __native_client__
-		glPointSize(6.);
-#endif
-		glUniform4fv(uniform_colour,1,glm::value_ptr(glm::vec4(1,0,1,1)));
-		glVertexAttribPointer(attrib_vertex,2,GL_FLOAT,GL_FALSE,0,0);
-		glDrawArrays(GL_POINTS,0,1);
-		glUniform4fv(uniform_colour,1,glm::value_ptr(const_cast<glm::vec4&>(colour)));
-		glCheck();	
-	}
-	if(nodes.size()) {
-		glBindBuffer(GL_ARRAY_BUFFER,vbo[1]);
-		if(dirty) {
-			const size_t data_size = nodes.size()*2;
-			GLfloat* const data = new GLfloat[data_size], *p = data;
-			for(nodes_t::const_iterator n=nodes.begin(); n!=nodes.end(); n++) {
-				*p++ = (*n)->pos.x;
-				*p++ = (*n)->pos.y;
-			}
-			glBufferData(GL_ARRAY_BUFFER,data_size*sizeof(GLfloat),data,GL_STATIC_DRAW);
-			glCheck();
-			delete[] data;
-		}
-#ifndef __native_client__ // no glPointSize
-		glPointSize(4.);
-#endif
-		glVertexAttribPointer(attrib_vertex,2,GL_FLOAT,GL_FALSE,0,0);
-		glDrawArrays(GL_POINTS,0,nodes.size());
-		glCheck();
-	}
-	glBindBuffer(GL_ARRAY_BUFFER,0);
-	glDisableVertexAttribArray(attrib_vertex);
-	glUseProgram(0);
-	glCheck();
-	dirty = false;
+	static const float z = -2; // in front of the world
+	batch_2d_t& batch = main.get_batch_2d();
+	for(links_t::const_iterator l=links.begin(); l!=links.end(); l++)
+		batch.line(projection,glm::vec3((*l)->a->pos,z),glm::vec3((*l)->b->pos,z),colour);
+	// nodes are squares a few units across, the active one bigger, beneath
+	if(active_node)
+		batch.quad(projection,glm::vec3(active_node->pos-glm::vec2(3,3),z),active_node->pos+glm::vec2(3,3),glm::vec4(1,0,1,1));
+	for(nodes_t::const_iterator n=nodes.begin(); n!=nodes.end(); n++)
+		batch.quad(projection,glm::vec3((*n)->pos-glm::vec2(2,2),z),(*n)->pos+glm::vec2(2,2),colour);
 }
 
 path_t::node_t* path_t::nearest(const glm::vec2& p,float threshold) {
@@ -184,10 +123,8 @@ path_t::link_t* path_t::nearest_link(const glm::vec2& p,float threshold) {
 void path_t::on_mouse_down(int x,int y,main_t::mouse_button_t button,const main_t::input_key_map_t& map,const main_t::input_mouse_map_t& mouse) {
 	const glm::vec2 pos(x,y);
 	if(button == main_t::MOUSE_DRAG) {
-		if(active_node) {
+		if(active_node)
 			active_node->pos = pos;
-			dirty = true;
-		}
 	} else if(node_t* new_active_node = nearest(pos)) {
 		if(active_node) { // if they are not linked, join them
 			bool joined = false;
@@ -198,7 +135,6 @@ void path_t::on_mouse_down(int x,int y,main_t::mouse_button_t button,const main_
 				links.push_back(link);
 				active_node->links.push_back(link);
 				new_active_node->links.push_back(link);
-				dirty = true;
 			}
 		}
 		active_node = new_active_node;
@@ -213,7 +149,6 @@ void path_t::on_mouse_down(int x,int y,main_t::mouse_button_t button,const main_
 		links.push_back(link);
 		active_node->links.push_back(link);
 		b->links.push_back(link);
-		dirty = true;
 	} else {
 		node_t* new_active_node = new node_t(id_seq++,pos);
 		if(active_node) {
@@ -223,7 +158,6 @@ void path_t::on_mouse_down(int x,int y,main_t::mouse_button_t button,const main_
 			new_active_node->links.push_back(link);
 		}
 		nodes.push_back(new_active_node);
-		dirty = true;
 		active_node = new_active_node;
 	}
 }
@@ -250,7 +184,6 @@ bool path_t::on_key_up(short code,const main_t::input_key_map_t& map,const main_
 			nodes.erase(std::find(nodes.begin(),nodes.end(),active_node));
 			delete active_node;
 			active_node = NULL;
-			dirty = true;
 		}
 		return true;
 	default:
@@ -21,8 +21,6 @@ public:
 	bool on_key_down(short code,const main_t::input_key_map_t& map,const main_t::input_mouse_map_t& mouse);
 	bool on_key_up(short code,const main_t::input_key_map_t& map,const main_t::input_mouse_map_t& mouse);
 private:
-	GLuint program, vbo[3], uniform_colour, uniform_mvp_matrix, attrib_vertex;
-	bool dirty;
 	struct link_t;
 	typedef std::vector<link_t*> links_t;
 	struct node_t {
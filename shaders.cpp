@@ -1,19 +1,24 @@
 
 #include "barebones/main.hpp"
+#include "barebones/g3d.hpp"
 
 void create_shaders(main_t& main) {
 	main.set_shared_program("g3d_single_frame",main.create_program(
 		"uniform mat4 MVP_MATRIX;\n"
 		"uniform mat3 NORMAL_MATRIX;\n"
+		"uniform vec3 VERTEX_OFFSET;\n" // quantised models are dequantised here; float ones have offset 0 and scale 1
+		"uniform vec3 VERTEX_SCALE;\n"
+		"uniform vec2 TEX_OFFSET;\n"
+		"uniform vec2 TEX_SCALE;\n"
 		"attribute vec3 VERTEX_0;\n"
 		"attribute vec3 NORMAL_0;\n"
 		"attribute vec2 TEX_COORD_0;\n"
 		"varying vec2 tex_coord_0;\n"
 		"varying vec3 normal;\n"
 		"void main() {\n"
-		"	gl_Position = MVP_MATRIX * vec4(VERTEX_0,1.);\n"
+		"	gl_Position = MVP_MATRIX * vec4(VERTEX_OFFSET + VERTEX_0 * VERTEX_SCALE,1.);\n"
 		"	normal = NORMAL_MATRIX * NORMAL_0;\n"
-		"	tex_coord_0 = TEX_COORD_0;\n"
+		"	tex_coord_0 = TEX_OFFSET + TEX_COORD_0 * TEX_SCALE;\n"
 		"}\n",
 		"uniform vec4 COLOUR;\n"
 		"uniform sampler2D TEX_UNIT_0;\n"
@@ -29,6 +34,10 @@ void create_shaders(main_t& main) {
 		"uniform mat4 MVP_MATRIX;\n"
 		"uniform mat3 NORMAL_MATRIX;\n"
 		"uniform float LERP;\n"
+		"uniform vec3 VERTEX_OFFSET;\n" // quantised models are dequantised here; float ones have offset 0 and scale 1
+		"uniform vec3 VERTEX_SCALE;\n"
+		"uniform vec2 TEX_OFFSET;\n"
+		"uniform vec2 TEX_SCALE;\n"
 		"attribute vec3 VERTEX_0;\n"
 		"attribute vec3 NORMAL_0;\n"
 		"attribute vec3 VERTEX_1;\n"
@@ -37,9 +46,11 @@ void create_shaders(main_t& main) {
 		"varying vec2 tex_coord_0;\n"
 		"varying vec3 normal;\n"
 		"void main() {\n"
-		"	gl_Position = mix(MVP_MATRIX * vec4(VERTEX_0,1.),MVP_MATRIX * vec4(VERTEX_1,1.),LERP);\n"
+		"	vec4 vertex_0 = vec4(VERTEX_OFFSET + VERTEX_0 * VERTEX_SCALE,1.);\n"
+		"	vec4 vertex_1 = vec4(VERTEX_OFFSET + VERTEX_1 * VERTEX_SCALE,1.);\n"
+		"	gl_Position = mix(MVP_MATRIX * vertex_0,MVP_MATRIX * vertex_1,LERP);\n"
 		"	normal = mix(NORMAL_MATRIX * NORMAL_0,NORMAL_MATRIX * NORMAL_1,LERP);\n"
-		"	tex_coord_0 = TEX_COORD_0;\n"
+		"	tex_coord_0 = TEX_OFFSET + TEX_COORD_0 * TEX_SCALE;\n"
 		"}\n",
 		"uniform vec4 COLOUR;\n"
 		"uniform sampler2D TEX_UNIT_0;\n"
@@ -51,30 +62,146 @@ void create_shaders(main_t& main) {
 		"	float intensity = min(max(dot(LIGHT_0,normal),0.6),1.);\n"
 		"	gl_FragColor = vec4(COLOUR.rgb * texel * intensity,COLOUR.a);\n"
 		"}\n"));
-	main.set_shared_program("path_t",main.create_program(
+	if(g3d_t::frame_textures_supported())
+		main.set_shared_program("g3d_frame_texture",main.create_program(
 			"uniform mat4 MVP_MATRIX;\n"
-			"attribute vec2 VERTEX;\n"
+			"uniform mat3 NORMAL_MATRIX;\n"
+			"uniform float LERP;\n"
+			"uniform sampler2D FRAMES;\n" // per frame, per vertex: a position texel then a normal texel
+			"uniform vec2 FRAMES_SIZE;\n"
+			"uniform float FRAME_0;\n" // the first texel of each frame
+			"uniform float FRAME_1;\n"
+			"attribute float VERTEX_INDEX;\n"
+			"attribute vec2 TEX_COORD_0;\n"
+			"varying vec2 tex_coord_0;\n"
+			"varying vec3 normal;\n"
+			"vec3 fetch(float texel) {\n"
+			"	float row = floor(texel / FRAMES_SIZE.x);\n"
+			"	return texture2DLod(FRAMES,vec2(texel - row * FRAMES_SIZE.x + .5,row + .5) / FRAMES_SIZE,0.).xyz;\n"
+			"}\n"
 			"void main() {\n"
-			"	gl_Position = MVP_MATRIX * vec4(VERTEX,-2.,1.);\n"
+			"	float ofs = VERTEX_INDEX * 2.;\n"
+			"	vec4 vertex_0 = vec4(fetch(FRAME_0 + ofs),1.);\n"
+			"	vec4 vertex_1 = vec4(fetch(FRAME_1 + ofs),1.);\n"
+			"	gl_Position = mix(MVP_MATRIX * vertex_0,MVP_MATRIX * vertex_1,LERP);\n"
+			"	normal = mix(NORMAL_MATRIX * fetch(FRAME_0 + ofs + 1.),NORMAL_MATRIX * fetch(FRAME_1 + ofs + 1.),LERP);\n"
+			"	tex_coord_0 = TEX_COORD_0;\n"
 			"}\n",
 			"uniform vec4 COLOUR;\n"
+			"uniform sampler2D TEX_UNIT_0;\n"
+			"uniform vec3 LIGHT_0;\n"
+			"varying vec2 tex_coord_0;\n"
+			"varying vec3 normal;\n"
 			"void main() {\n"
-			"	gl_FragColor = COLOUR;\n"
+			"	vec3 texel = texture2D(TEX_UNIT_0,tex_coord_0).rgb;\n"
+			"	float intensity = min(max(dot(LIGHT_0,normal),0.6),1.);\n"
+			"	gl_FragColor = vec4(COLOUR.rgb * texel * intensity,COLOUR.a);\n"
 			"}\n"));
-	main.set_shared_program("splash",main.create_program(
-			"attribute vec2 VERTEX;\n"
+	if(g3d_t::instancing_supported()) {
+		// as g3d_single_frame and g3d_multi_frame, but each instance has its own transforms, lerp and colour
+		const char* const instanced_fragment =
+			"uniform sampler2D TEX_UNIT_0;\n"
+			"uniform vec3 LIGHT_0;\n"
+			"varying vec2 tex_coord_0;\n"
+			"varying vec3 normal;\n"
+			"varying vec4 colour;\n"
+			"void main() {\n"
+			"	vec3 texel = texture2D(TEX_UNIT_0,tex_coord_0).rgb;\n"
+			"	float intensity = min(max(dot(LIGHT_0,normal),.6),1.);\n"
+			"	gl_FragColor = vec4(colour.rgb * texel * intensity,colour.a);\n"
+			"}\n";
+		main.set_shared_program("g3d_single_frame_instanced",main.create_program(
+			"uniform vec3 VERTEX_OFFSET;\n"
+			"uniform vec3 VERTEX_SCALE;\n"
+			"uniform vec2 TEX_OFFSET;\n"
+			"uniform vec2 TEX_SCALE;\n"
+			"attribute mat4 INSTANCE_MVP_MATRIX;\n"
+			"attribute mat3 INSTANCE_NORMAL_MATRIX;\n"
+			"attribute vec4 INSTANCE_COLOUR;\n"
+			"attribute vec3 VERTEX_0;\n"
+			"attribute vec3 NORMAL_0;\n"
 			"attribute vec2 TEX_COORD_0;\n"
 			"varying vec2 tex_coord_0;\n"
+			"varying vec3 normal;\n"
+			"varying vec4 colour;\n"
+			"void main() {\n"
+			"	gl_Position = INSTANCE_MVP_MATRIX * vec4(VERTEX_OFFSET + VERTEX_0 * VERTEX_SCALE,1.);\n"
+			"	normal = INSTANCE_NORMAL_MATRIX * NORMAL_0;\n"
+			"	tex_coord_0 = TEX_OFFSET + TEX_COORD_0 * TEX_SCALE;\n"
+			"	colour = INSTANCE_COLOUR;\n"
+			"}\n",
+			instanced_fragment));
+		main.set_shared_program("g3d_multi_frame_instanced",main.create_program(
+			"uniform vec3 VERTEX_OFFSET;\n"
+			"uniform vec3 VERTEX_SCALE;\n"
+			"uniform vec2 TEX_OFFSET;\n"
+			"uniform vec2 TEX_SCALE;\n"
+			"attribute mat4 INSTANCE_MVP_MATRIX;\n"
+			"attribute mat3 INSTANCE_NORMAL_MATRIX;\n"
+			"attribute float INSTANCE_LERP;\n"
+			"attribute vec4 INSTANCE_COLOUR;\n"
+			"attribute vec3 VERTEX_0;\n"
+			"attribute vec3 NORMAL_0;\n"
+			"attribute vec3 VERTEX_1;\n"
+			"attribute vec3 NORMAL_1;\n"
+			"attribute vec2 TEX_COORD_0;\n"
+			"varying vec2 tex_coord_0;\n"
+			"varying vec3 normal;\n"
+			"varying vec4 colour;\n"
+			"void main() {\n"
+			"	vec4 vertex_0 = vec4(VERTEX_OFFSET + VERTEX_0 * VERTEX_SCALE,1.);\n"
+			"	vec4 vertex_1 = vec4(VERTEX_OFFSET + VERTEX_1 * VERTEX_SCALE,1.);\n"
+			"	gl_Position = mix(INSTANCE_MVP_MATRIX * vertex_0,INSTANCE_MVP_MATRIX * vertex_1,INSTANCE_LERP);\n"
+			"	normal = mix(INSTANCE_NORMAL_MATRIX * NORMAL_0,INSTANCE_NORMAL_MATRIX * NORMAL_1,INSTANCE_LERP);\n"
+			"	tex_coord_0 = TEX_OFFSET + TEX_COORD_0 * TEX_SCALE;\n"
+			"	colour = INSTANCE_COLOUR;\n"
+			"}\n",
+			instanced_fragment));
+	}
+	// batch_2d_t transforms as it goes
+	main.set_shared_program("batch_2d",main.create_program(
+			"attribute vec4 VERTEX;\n"
+			"attribute vec4 COLOUR;\n"
+			"varying vec4 colour;\n"
+			"void main() {\n"
+			"	gl_Position = VERTEX;\n"
+			"	colour = COLOUR;\n"
+			"}\n",
+			"varying vec4 colour;\n"
 			"void main() {\n"
-			"	gl_Position = vec4(VERTEX,-1.,1.);\n"
+			"	gl_FragColor = colour;\n"
+			"}\n"));
+	main.set_shared_program("batch_2d_textured",main.create_program(
+			"attribute vec4 VERTEX;\n"
+			"attribute vec4 COLOUR;\n"
+			"attribute vec2 TEX_COORD_0;\n"
+			"varying vec4 colour;\n"
+			"varying vec2 tex_coord_0;\n"
+			"void main() {\n"
+			"	gl_Position = VERTEX;\n"
+			"	colour = COLOUR;\n"
+			"	tex_coord_0 = TEX_COORD_0;\n"
+			"}\n",
+			"uniform sampler2D TEX_UNIT_0;\n"
+			"varying vec4 colour;\n"
+			"varying vec2 tex_coord_0;\n"
+			"void main() {\n"
+			"	gl_FragColor = texture2D(TEX_UNIT_0,tex_coord_0)*colour;\n"
+			"}\n"));
+	main.set_shared_program("tile_cache",main.create_program(
+			"uniform mat4 MVP_MATRIX;\n"
+			"attribute vec3 VERTEX;\n"
+			"attribute vec2 TEX_COORD_0;\n"
+			"varying vec2 tex_coord_0;\n"
+			"void main() {\n"
+			"	gl_Position = MVP_MATRIX * vec4(VERTEX,1.);\n"
 			"	tex_coord_0 = TEX_COORD_0;\n"
 			"}\n",
-			"uniform vec4 COLOUR;\n"
 			"uniform sampler2D TEX_UNIT_0;\n"
 			"varying vec2 tex_coord_0;\n"
 			"void main() {\n"
-			"	vec4 texel = texture2D(TEX_UNIT_0,tex_coord_0);\n"
-			"	gl_FragColor = texel*COLOUR;\n"
+			"	gl_FragColor = texture2D(TEX_UNIT_0,tex_coord_0);\n"
 			"}\n"));
+	main.link_programs(); // after creating them all, so the driver can compile them at once
 }
 
@@ -0,0 +1,133 @@
+// parse-throughput micro-benchmark of the G3D loader over a directory of models;
+// compares g3d_data_t against the byte-at-a-time reader it replaced
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "tools.hpp"
+#include "../barebones/g3d.hpp"
+#include "../barebones/rand.hpp"
+
+namespace {
+
+	// the reader as it was before bulk reads, kept only as the benchmark baseline
+	class legacy_reader_t {
+	public:
+		legacy_reader_t(const std::string& d): data(d), ofs(0) {}
+		inline uint8_t byte() { return _r<uint8_t>(); }
+		inline uint16_t uint16() { return _r<uint16_t>(); };
+		inline uint32_t uint32() { return _r<uint32_t>(); };
+		inline float float32() { return _r<float>(); }
+		inline void skip(size_t bytes) { ofs += bytes; }
+		inline void read(void* dest,size_t bytes) { for(char* d = reinterpret_cast<char*>(dest); bytes--; d++) *d = data.at(ofs++); }
+		template<int N> std::string fixed_str() { ofs += N; return data.substr(ofs-N,N); }
+	private:
+		template<typename T> T _r() { T v; read(&v,sizeof(T)); return v; }
+		const std::string& data;
+		size_t ofs;
+	};
+
+	void legacy_load(const std::string& bytes,g3d_data_t& g3d) {
+		legacy_reader_t in(bytes);
+		const uint32_t ver = in.uint32();
+		if(((ver&0xff)!='G')||(((ver>>8)&0xff)!='3')||(((ver>>16)&0xff)!='D')||((ver>>24)!=4))
+			data_error("(" << std::hex << ver << ") is not a G3D v4 model");
+		g3d.meshes.resize(in.uint16());
+		in.byte();
+		for(g3d_data_t::meshes_t::iterator m=g3d.meshes.begin(); m!=g3d.meshes.end(); m++) {
+			g3d_data_t::mesh_t& mesh = *m;
+			mesh.name = std::string(in.fixed_str<64>().c_str());
+			mesh.frame_count = in.uint32();
+			mesh.vertex_count = in.uint32();
+			mesh.index_count = in.uint32();
+			in.skip(9*4);
+			mesh.textures = in.uint32();
+			for(int t=0; t<5; t++)
+				if((1<<t)&mesh.textures)
+					in.fixed_str<64>();
+			mesh.tex_frame_count = mesh.textures?1:0;
+			mesh.vn_data.resize(mesh.vertex_count*mesh.frame_count*6);
+			for(int pass=0; pass<2; pass++)
+				for(uint32_t f=0; f<mesh.frame_count; f++)
+					for(uint32_t v=0; v<mesh.vertex_count; v++)
+						for(int j=0; j<3; j++) {
+							const size_t slot = f*mesh.vertex_count*6 + v*6 + pass*3 + j;
+							mesh.vn_data[slot] = in.float32();
+							mesh.min[j] = std::min(mesh.vn_data[slot],mesh.min[j]);
+							mesh.max[j] = std::max(mesh.vn_data[slot],mesh.max[j]);
+						}
+			mesh.t_data.resize(mesh.tex_frame_count*mesh.vertex_count*2);
+			for(size_t slot=0; slot<mesh.t_data.size(); slot+=2) {
+				mesh.t_data[slot] = in.float32();
+				mesh.t_data[slot+1] = 1.-in.float32();
+			}
+			mesh.i_data.resize(mesh.index_count);
+			for(uint32_t i=0; i<mesh.index_count; i++)
+				mesh.i_data[i] = in.uint32();
+		}
+	}
+
+	double mb_per_sec(size_t bytes,int iterations,uint64_t ns) {
+		return ns? ((double)bytes*iterations/(1024*1024)) / ((double)ns/1000000000): 0;
+	}
+
+} // anon namespace
+
+int main(int argc,char** args) {
+	int iterations = 20;
+	std::vector<std::string> paths;
+	for(int i=1; i<argc; i++) {
+		const std::string arg(args[i]);
+		if(arg == "-n" && i+1<argc)
+			iterations = std::max(1,atoi(args[++i]));
+		else if(arg.size() && arg.at(0) == '-') {
+			std::cerr << "usage: " << args[0] << " [-n iterations] [file|dir ...]" << std::endl;
+			return EXIT_FAILURE;
+		} else
+			paths.push_back(arg);
+	}
+	if(!paths.size())
+		paths.push_back("data");
+	try {
+		std::vector<std::string> files;
+		for(std::vector<std::string>::const_iterator p=paths.begin(); p!=paths.end(); p++)
+			find_files(*p,".g3d",files);
+		size_t total_bytes = 0;
+		uint64_t total_legacy = 0, total_bulk = 0;
+		std::cout << std::fixed << std::setprecision(1) <<
+			std::setw(48) << std::left << "file" << std::right << std::setw(10) << "bytes" <<
+			std::setw(12) << "before MB/s" << std::setw(12) << "after MB/s" << std::setw(9) << "speedup" << std::endl;
+		for(std::vector<std::string>::const_iterator f=files.begin(); f!=files.end(); f++) {
+			const std::string bytes = read_all(*f);
+			uint64_t start = high_precision_time();
+			for(int i=0; i<iterations; i++) {
+				g3d_data_t g3d;
+				legacy_load(bytes,g3d);
+			}
+			const uint64_t legacy = high_precision_time()-start;
+			start = high_precision_time();
+			for(int i=0; i<iterations; i++) {
+				g3d_data_t g3d;
+				binary_reader_t in(bytes);
+				g3d.load(in,false); // just the parsing, as the legacy reader did
+			}
+			const uint64_t bulk = high_precision_time()-start;
+			std::cout << std::setw(48) << std::left << *f << std::right << std::setw(10) << bytes.size() <<
+				std::setw(12) << mb_per_sec(bytes.size(),iterations,legacy) <<
+				std::setw(12) << mb_per_sec(bytes.size(),iterations,bulk) <<
+				std::setw(8) << (bulk? (double)legacy/bulk: 0) << 'x' << std::endl;
+			total_bytes += bytes.size();
+			total_legacy += legacy;
+			total_bulk += bulk;
+		}
+		std::cout << std::setw(48) << std::left << "TOTAL" << std::right << std::setw(10) << total_bytes <<
+			std::setw(12) << mb_per_sec(total_bytes,iterations,total_legacy) <<
+			std::setw(12) << mb_per_sec(total_bytes,iterations,total_bulk) <<
+			std::setw(8) << (total_bulk? (double)total_legacy/total_bulk: 0) << 'x' << std::endl;
+	} catch(std::exception& e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
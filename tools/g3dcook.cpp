@@ -0,0 +1,251 @@
+// converts G3D models to the cooked format g3d_t can upload without touching,
+// and dumps where the bytes go
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "tools.hpp"
+#include "../barebones/g3d.hpp"
+#include "../barebones/rand.hpp"
+
+namespace {
+
+	struct stats_t {
+		stats_t(): files(0), meshes(0), frames(0), vertices(0), vn_bytes(0), t_bytes(0), i_bytes(0), src_bytes(0), cooked_bytes(0) {}
+		size_t files, meshes, frames, vertices, vn_bytes, t_bytes, i_bytes, src_bytes, cooked_bytes;
+	};
+
+	void print_header() {
+		std::cout << std::setw(40) << std::left << "file:mesh" << std::right <<
+			std::setw(7) << "frames" << std::setw(9) << "vertices" << std::setw(9) << "indices" <<
+			std::setw(12) << "bytes/frame" << std::setw(11) << "vn bytes" << std::setw(9) << "uv bytes" <<
+			std::setw(9) << "i bytes" << std::endl;
+	}
+
+	void print_mesh(const std::string& file,const g3d_data_t::mesh_t& mesh,stats_t& stats) {
+		const size_t vn_bytes = mesh.frame_count*mesh.vn_frame_size(), t_bytes = mesh.tex_frame_count*mesh.t_frame_size();
+		std::cout << std::setw(40) << std::left << (file+':'+mesh.name) << std::right <<
+			std::setw(7) << mesh.frame_count << std::setw(9) << mesh.vertex_count << std::setw(9) << mesh.index_count <<
+			std::setw(12) << mesh.vn_frame_size() << std::setw(11) << vn_bytes << std::setw(9) << t_bytes <<
+			std::setw(9) << mesh.i_size() << std::endl;
+		stats.meshes++;
+		stats.frames += mesh.frame_count;
+		stats.vertices += mesh.vertex_count;
+		stats.vn_bytes += vn_bytes;
+		stats.t_bytes += t_bytes;
+		stats.i_bytes += mesh.i_size();
+	}
+
+	void print_quantise_header() {
+		std::cout << std::setw(40) << std::left << "file:mesh" << std::right <<
+			std::setw(12) << "extent" << std::setw(12) << "max error" << std::setw(12) << "rms error" <<
+			std::setw(10) << "max %" << std::setw(12) << "normal err" << std::setw(12) << "uv err" << std::endl;
+	}
+
+	void print_quantise(const std::string& file,const g3d_data_t::mesh_t& mesh) {
+		const g3d_data_t::quantised_t q(mesh,g3d_data_t::quantised_t::NORMAL_10_10_10_2);
+		const float extent = std::max(q.vertex_scale.x,std::max(q.vertex_scale.y,q.vertex_scale.z));
+		std::cout << std::setw(40) << std::left << (file+':'+mesh.name) << std::right << std::setprecision(3) <<
+			std::setw(12) << extent << std::setw(12) << q.max_vertex_error << std::setw(12) << q.rms_vertex_error <<
+			std::setw(10) << (100.*q.max_vertex_error/extent) << std::setw(12) << q.max_normal_error <<
+			std::setw(12) << q.max_tex_error << std::endl;
+	}
+
+	void print_cache_header() {
+		std::cout << std::setw(40) << std::left << "file:mesh" << std::right <<
+			std::setw(9) << "indices" << std::setw(11) << "ACMR was" << std::setw(9) << "now" <<
+			std::setw(11) << "ATVR was" << std::setw(9) << "now" << std::setw(10) << "ms" << std::endl;
+	}
+
+	// indices and transforms are summed so the totals are weighted by triangle count
+	struct cache_totals_t {
+		cache_totals_t(): indices(0), transforms_before(0), transforms_after(0), ms(0) {}
+		size_t indices;
+		double transforms_before, transforms_after, ms;
+	};
+
+	void print_cache(const std::string& file,g3d_data_t::mesh_t mesh,cache_totals_t& totals) {
+		const g3d_data_t::cache_stats_t before = mesh.cache_stats();
+		const uint64_t start = high_precision_time();
+		mesh.optimise();
+		const double ms = (high_precision_time()-start)/1000000.;
+		const g3d_data_t::cache_stats_t after = mesh.cache_stats();
+		std::cout << std::setw(40) << std::left << (file+':'+mesh.name) << std::right << std::fixed << std::setprecision(3) <<
+			std::setw(9) << mesh.index_count << std::setw(11) << before.acmr << std::setw(9) << after.acmr <<
+			std::setw(11) << before.atvr << std::setw(9) << after.atvr << std::setw(10) << ms << std::endl;
+		std::cout.unsetf(std::ios::fixed);
+		totals.indices += mesh.index_count;
+		totals.transforms_before += before.acmr*mesh.index_count/3;
+		totals.transforms_after += after.acmr*mesh.index_count/3;
+		totals.ms += ms;
+	}
+
+	void print_decimate_header() {
+		std::cout << std::setw(40) << std::left << "file:mesh" << std::right <<
+			std::setw(8) << "frames" << std::setw(7) << "kept" << std::setw(12) << "bytes was" << std::setw(12) << "now" << std::endl;
+	}
+
+	struct decimate_totals_t {
+		decimate_totals_t(): frames_before(0), frames_after(0), bytes_before(0), bytes_after(0) {}
+		size_t frames_before, frames_after, bytes_before, bytes_after;
+	};
+
+	void print_decimate(const std::string& file,g3d_data_t::mesh_t& mesh,float max_error,decimate_totals_t& totals) {
+		const uint32_t before = mesh.frame_count;
+		mesh.decimate(max_error);
+		std::cout << std::setw(40) << std::left << (file+':'+mesh.name) << std::right <<
+			std::setw(8) << before << std::setw(7) << mesh.frame_count <<
+			std::setw(12) << before*mesh.vn_frame_size() << std::setw(12) << mesh.frame_count*mesh.vn_frame_size() << std::endl;
+		totals.frames_before += before;
+		totals.frames_after += mesh.frame_count;
+		totals.bytes_before += before*mesh.vn_frame_size();
+		totals.bytes_after += mesh.frame_count*mesh.vn_frame_size();
+	}
+
+	void print_lod_header() {
+		std::cout << std::setw(40) << std::left << "file:mesh" << std::right <<
+			std::setw(10) << "triangles" << "  levels (triangles@error)" << std::endl;
+	}
+
+	struct lod_totals_t {
+		lod_totals_t(): meshes(0), with_lods(0), tris(0), coarsest_tris(0), ms(0) {}
+		size_t meshes, with_lods, tris, coarsest_tris;
+		double ms;
+	};
+
+	void print_lod(const std::string& file,g3d_data_t::mesh_t& mesh,float max_error,lod_totals_t& totals) {
+		const uint64_t start = high_precision_time();
+		mesh.build_lods(max_error);
+		totals.ms += (high_precision_time()-start)/1000000.;
+		std::cout << std::setw(40) << std::left << (file+':'+mesh.name) << std::right <<
+			std::setw(10) << mesh.index_count/3 << ' ';
+		for(g3d_data_t::mesh_t::lods_t::const_iterator l=mesh.lods.begin(); l!=mesh.lods.end(); l++)
+			std::cout << ' ' << l->index_count/3 << '@' << std::setprecision(3) << l->error;
+		std::cout << std::endl;
+		totals.meshes++;
+		totals.with_lods += !mesh.lods.empty();
+		totals.tris += mesh.index_count/3;
+		totals.coarsest_tris += (mesh.lods.empty()? mesh.index_count: mesh.lods.back().index_count)/3;
+	}
+
+	void print_totals(const stats_t& stats) {
+		std::cout << stats.files << " files, " << stats.meshes << " meshes, " << stats.frames << " frames, " <<
+			stats.vertices << " vertices per frame" << std::endl <<
+			"GPU bytes: " << (stats.vn_bytes+stats.t_bytes+stats.i_bytes) << " (vertices+normals " << stats.vn_bytes <<
+			", uvs " << stats.t_bytes << ", indices " << stats.i_bytes << ')' << std::endl <<
+			"file bytes: " << stats.src_bytes << " source, " << stats.cooked_bytes << " cooked" << std::endl;
+	}
+
+} // anon namespace
+
+int main(int argc,char** args) {
+	bool stats = false, quantise = false, cache = false, write = true;
+	float decimate = 0, lod = 0;
+	std::vector<std::string> paths;
+	for(int i=1; i<argc; i++) {
+		const std::string arg(args[i]);
+		if(arg == "-stats")
+			stats = true;
+		else if(arg == "-quantise")
+			quantise = true;
+		else if(arg == "-cache")
+			cache = true;
+		else if(arg == "-n")
+			write = false;
+		else if(arg == "-decimate" && i+1<argc && (decimate = atof(args[i+1])) > 0)
+			i++;
+		else if(arg == "-lod" && i+1<argc && (lod = atof(args[i+1])) > 0)
+			i++;
+		else if(arg.size() && arg.at(0) == '-') {
+			std::cerr << "usage: " << args[0] << " [-stats] [-quantise] [-cache] [-decimate error] [-lod error] [-n] [file|dir ...]" << std::endl <<
+				"  writes a .g3dc beside each .g3d; -n writes nothing" << std::endl <<
+				"  -quantise reports the loss from storing vertices quantised" << std::endl <<
+				"  -cache reports ACMR and ATVR for a " << g3d_data_t::VERTEX_CACHE_SIZE <<
+				"-entry FIFO before and after optimising" << std::endl <<
+				"  -decimate drops frames lerping reproduces to within error (e.g. 0.002) of each mesh's size" << std::endl <<
+				"  -lod builds levels of detail down to error (e.g. 0.01) of each mesh's size" << std::endl;
+			return EXIT_FAILURE;
+		} else
+			paths.push_back(arg);
+	}
+	if(!paths.size())
+		paths.push_back("data");
+	try {
+		std::vector<std::string> files;
+		for(std::vector<std::string>::const_iterator p=paths.begin(); p!=paths.end(); p++)
+			find_files(*p,".g3d",files);
+		stats_t totals;
+		decimate_totals_t decimated;
+		lod_totals_t lods;
+		if(decimate > 0)
+			print_decimate_header();
+		if(lod > 0)
+			print_lod_header();
+		if(stats)
+			print_header();
+		for(std::vector<std::string>::const_iterator f=files.begin(); f!=files.end(); f++) {
+			const std::string bytes = read_all(*f);
+			binary_reader_t in(bytes);
+			g3d_data_t g3d;
+			try {
+				g3d.load(in);
+			} catch(data_error_t& e) {
+				data_error(*f << ": " << e.what());
+			}
+			if(decimate > 0)
+				for(g3d_data_t::meshes_t::iterator m=g3d.meshes.begin(); m!=g3d.meshes.end(); m++)
+					print_decimate(*f,*m,decimate,decimated);
+			if(lod > 0)
+				for(g3d_data_t::meshes_t::iterator m=g3d.meshes.begin(); m!=g3d.meshes.end(); m++)
+					print_lod(*f,*m,lod,lods);
+			const std::string cooked = g3d.cooked? bytes: g3d.cook();
+			if(write && !g3d.cooked)
+				write_all(*f+'c',cooked);
+			totals.files++;
+			totals.src_bytes += bytes.size();
+			totals.cooked_bytes += cooked.size();
+			if(stats)
+				for(g3d_data_t::meshes_t::const_iterator m=g3d.meshes.begin(); m!=g3d.meshes.end(); m++)
+					print_mesh(*f,*m,totals);
+		}
+		if(decimate > 0)
+			std::cout << "decimation kept " << decimated.frames_after << " of " << decimated.frames_before << " frames, " <<
+				decimated.bytes_after << " of " << decimated.bytes_before << " frame bytes" << std::endl;
+		if(lod > 0)
+			std::cout << lods.with_lods << " of " << lods.meshes << " meshes have levels of detail; the coarsest draw " <<
+				lods.coarsest_tris << " of " << lods.tris << " triangles, building them took " << lods.ms << "ms" << std::endl;
+		if(stats)
+			print_totals(totals);
+		if(quantise) {
+			print_quantise_header();
+			for(std::vector<std::string>::const_iterator f=files.begin(); f!=files.end(); f++) {
+				const std::string bytes = read_all(*f);
+				binary_reader_t in(bytes);
+				g3d_data_t g3d;
+				g3d.load(in);
+				for(g3d_data_t::meshes_t::const_iterator m=g3d.meshes.begin(); m!=g3d.meshes.end(); m++)
+					print_quantise(*f,*m);
+			}
+		}
+		if(cache) {
+			print_cache_header();
+			cache_totals_t totals;
+			for(std::vector<std::string>::const_iterator f=files.begin(); f!=files.end(); f++) {
+				const std::string bytes = read_all(*f);
+				binary_reader_t in(bytes);
+				g3d_data_t g3d;
+				g3d.load(in,false);
+				for(g3d_data_t::meshes_t::const_iterator m=g3d.meshes.begin(); m!=g3d.meshes.end(); m++)
+					print_cache(*f,*m,totals);
+			}
+			if(totals.indices)
+				std::cout << "overall ACMR " << (totals.transforms_before*3/totals.indices) << " -> " <<
+					(totals.transforms_after*3/totals.indices) << ", optimising took " << totals.ms << "ms" << std::endl;
+		}
+	} catch(std::exception& e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
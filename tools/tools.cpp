@@ -0,0 +1,51 @@
+#include "tools.hpp"
+#include "../barebones/main.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+
+bool has_ext(const std::string& path,const std::string& ext) {
+	if(path.size() < ext.size()) return false;
+	for(size_t i=0, j=path.size()-ext.size(); i<ext.size(); i++, j++)
+		if(tolower(path[j]) != tolower(ext[i]))
+			return false;
+	return true;
+}
+
+void find_files(const std::string& path,const std::string& ext,std::vector<std::string>& found) {
+	struct stat st;
+	if(stat(path.c_str(),&st))
+		data_error("cannot stat " << path);
+	if(!S_ISDIR(st.st_mode)) {
+		found.push_back(path);
+		return;
+	}
+	DIR* dir = opendir(path.c_str());
+	if(!dir) data_error("cannot open " << path);
+	while(dirent* entry = readdir(dir)) {
+		const std::string name(entry->d_name);
+		if(name == "." || name == "..") continue;
+		const std::string child = path + "/" + name;
+		if(!stat(child.c_str(),&st) && S_ISDIR(st.st_mode))
+			find_files(child,ext,found);
+		else if(has_ext(child,ext))
+			found.push_back(child);
+	}
+	closedir(dir);
+	std::sort(found.begin(),found.end());
+}
+
+std::string read_all(const std::string& path) {
+	std::ifstream in(path.c_str(),std::ios::in|std::ios::binary);
+	if(!in) data_error("cannot read " << path);
+	return std::string((std::istreambuf_iterator<char>(in)),std::istreambuf_iterator<char>());
+}
+
+void write_all(const std::string& path,const std::string& bytes) {
+	std::ofstream out(path.c_str(),std::ios::out|std::ios::binary|std::ios::trunc);
+	if(!out.write(bytes.data(),bytes.size()))
+		data_error("cannot write " << path);
+}
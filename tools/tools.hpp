@@ -0,0 +1,14 @@
+#ifndef __TOOLS_HPP__
+#define __TOOLS_HPP__
+
+// file helpers shared by the offline tools
+
+#include <string>
+#include <vector>
+
+bool has_ext(const std::string& path,const std::string& ext); // case-insensitive, ext includes the dot
+void find_files(const std::string& path,const std::string& ext,std::vector<std::string>& found); // a file is taken as-is; dirs are recursed, sorted
+std::string read_all(const std::string& path); // throws data_error_t
+void write_all(const std::string& path,const std::string& bytes); // throws data_error_t
+
+#endif//__TOOLS_HPP__